@@ -0,0 +1,81 @@
+#include "corpus.h"
+#include <array>
+#include <random>
+#include <string_view>
+
+using namespace xlang::bench;
+
+namespace {
+
+constexpr auto MEMBER_TYPES = std::array<std::string_view, 4>{
+    "Int32", "Int64", "UInt8", "Pointer<UInt8>"};
+
+// Uses the engine's raw output, which the standard pins down exactly, rather
+// than a distribution, whose results vary between standard libraries.
+auto below(std::mt19937& random, size_t bound) -> size_t {
+    return random() % bound;
+}
+
+auto string_literal(std::mt19937& random, size_t length) -> std::string {
+    static constexpr std::string_view characters =
+        "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789";
+    std::string literal = "\"";
+    for (size_t i = 0; i < length; ++i) {
+        literal += characters[below(random, characters.size())];
+    }
+    return literal + "\"";
+}
+
+} // namespace
+
+auto xlang::bench::generate_corpus(const CorpusShape& shape) -> std::string {
+    auto random = std::mt19937{shape.seed};
+    std::string program =
+        "extern fn printf(format: Pointer<UInt8>, ...) -> Int32\n\n";
+    if (shape.call_depth > 0) {
+        program += "extern fn abs(value: Int32) -> Int32\n\n";
+    }
+
+    for (size_t i = 0; i < shape.structs; ++i) {
+        program += "struct Struct" + std::to_string(i) + " {\n";
+        for (size_t member = 0, count = 2 + below(random, 6); member < count;
+             ++member) {
+            program += "    member" + std::to_string(member) + ": ";
+            program += MEMBER_TYPES[below(random, MEMBER_TYPES.size())];
+            program += "\n";
+        }
+        program += "}\n\n";
+    }
+
+    for (size_t i = 0; i < shape.functions; ++i) {
+        const auto number = std::to_string(i);
+        program += "fn function" + number + "() -> Int32 {\n";
+        program += "    printf(" + string_literal(random, shape.string_length);
+        if (i > 0) {
+            program += ", function" + std::to_string(below(random, i)) + "()";
+        }
+        program += ")\n";
+        if (shape.chain_depth > 0) {
+            program += "    value" + number;
+            for (size_t link = 0; link < shape.chain_depth; ++link) {
+                program += ".link" + std::to_string(below(random, 8));
+            }
+            program += "()\n";
+        }
+        if (shape.call_depth > 0) {
+            program += "    ";
+            for (size_t call = 0; call < shape.call_depth; ++call) {
+                program += "abs(";
+            }
+            program += number + std::string(shape.call_depth, ')') + "\n";
+        }
+        program += "    return " + number + "\n}\n\n";
+    }
+
+    program += "fn main() {\n";
+    for (size_t i = 0; i < shape.functions; ++i) {
+        program += "    function" + std::to_string(i) + "()\n";
+    }
+    program += "}\n";
+    return program;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace xlang::bench {
+
+// What a generated program is made of. Programs without member chains compile
+// all the way to LLVM IR; chains only get through the parser for now.
+struct CorpusShape {
+    // Functions that print a string literal and call earlier functions. A
+    // main function calls every one of them.
+    size_t functions = 0;
+    // Structs with a handful of members each.
+    size_t structs = 0;
+    // Depth of the `a.b.c()` chain in every function, or 0 for none.
+    size_t chain_depth = 0;
+    // Depth of the `abs(abs(...))` call nested in every function, or 0 for
+    // none.
+    size_t call_depth = 0;
+    // Length of every string literal.
+    size_t string_length = 16;
+    uint32_t seed = 1;
+};
+
+// A program of the given shape. The same shape always gives the same text.
+auto generate_corpus(const CorpusShape& shape) -> std::string;
+
+} // namespace xlang::bench
@@ -0,0 +1,75 @@
+#include "bench/corpus.h"
+#include "core/lexer/lexer.h"
+#include "core/util/allocation_counter.h"
+#include <benchmark/benchmark.h>
+#include <string>
+
+using namespace xlang;
+
+namespace {
+
+auto make_program(int64_t functions) -> std::string {
+    return bench::generate_corpus(
+        bench::CorpusShape{.functions = static_cast<size_t>(functions)});
+}
+
+auto lex_benchmark(benchmark::State& state) -> void {
+    const auto program = make_program(state.range(0));
+    const auto isa = static_cast<ScanIsa>(state.range(1));
+    if (isa > best_scan_isa()) {
+        state.SkipWithError("instruction set not supported");
+        return;
+    }
+    state.SetLabel(ScanIsa_to_string(isa));
+    size_t tokens = 0;
+
+    const auto allocations = allocation_count();
+    for (auto _ : state) {
+        auto diagnostics = Diagnostics{};
+        auto result = lex(program, diagnostics, isa);
+        tokens = result.size();
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetBytesProcessed(
+        static_cast<int64_t>(state.iterations() * program.size()));
+    state.counters["tokens"] = static_cast<double>(tokens);
+    state.counters["allocations"] = benchmark::Counter(
+        static_cast<double>(allocation_count() - allocations),
+        benchmark::Counter::kAvgIterations);
+}
+
+// Scaling of lex_parallel() with the number of threads, on a program of a few
+// tens of megabytes.
+auto lex_parallel_benchmark(benchmark::State& state) -> void {
+    static const auto program = make_program(262144);
+    auto pool = ThreadPool{static_cast<size_t>(state.range(0))};
+    size_t tokens = 0;
+
+    for (auto _ : state) {
+        auto diagnostics = Diagnostics{};
+        auto result = lex_parallel(program, diagnostics, pool);
+        tokens = result.size();
+        benchmark::DoNotOptimize(result);
+    }
+
+    state.SetBytesProcessed(
+        static_cast<int64_t>(state.iterations() * program.size()));
+    state.counters["tokens"] = static_cast<double>(tokens);
+}
+
+} // namespace
+
+BENCHMARK(lex_benchmark)
+    ->ArgsProduct({
+        benchmark::CreateRange(64, 16384, 8),
+        {static_cast<int64_t>(ScanIsa::scalar),
+         static_cast<int64_t>(ScanIsa::sse2),
+         static_cast<int64_t>(ScanIsa::avx2)},
+    });
+
+BENCHMARK(lex_parallel_benchmark)
+    ->RangeMultiplier(2)
+    ->Range(1, static_cast<int64_t>(ThreadPool::default_thread_count()))
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
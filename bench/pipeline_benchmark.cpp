@@ -0,0 +1,196 @@
+#include "bench/corpus.h"
+#include "core/ir/ir.h"
+#include "core/lexer/lexer.h"
+#include "core/llvmir/llvmir.h"
+#include "core/parser/ast_cache.h"
+#include "core/parser/parser.h"
+#include "core/util/thread_pool.h"
+#include <benchmark/benchmark.h>
+#include <string>
+
+using namespace xlang;
+using namespace xlang::bench;
+
+namespace {
+
+namespace shapes {
+
+constexpr auto FUNCTIONS = CorpusShape{.functions = 4096};
+constexpr auto STRUCTS = CorpusShape{.functions = 16, .structs = 4096};
+constexpr auto LONG_STRINGS =
+    CorpusShape{.functions = 256, .string_length = 4096};
+constexpr auto MEMBER_CHAINS =
+    CorpusShape{.functions = 1024, .chain_depth = 16};
+
+} // namespace shapes
+
+// Every stage reports the throughput of the source text it started from, so
+// stages can be compared with each other.
+auto report(benchmark::State& state, const std::string& program) -> void {
+    state.SetBytesProcessed(
+        static_cast<int64_t>(state.iterations() * program.size()));
+}
+
+auto lex_benchmark(benchmark::State& state, CorpusShape shape) -> void {
+    const auto program = generate_corpus(shape);
+    for (auto _ : state) {
+        auto diagnostics = Diagnostics{};
+        auto tokens = lex(program, diagnostics);
+        benchmark::DoNotOptimize(tokens);
+    }
+    report(state, program);
+}
+
+auto parse_benchmark(benchmark::State& state, CorpusShape shape) -> void {
+    const auto program = generate_corpus(shape);
+    auto diagnostics = Diagnostics{};
+    const auto tokens = lex(program, diagnostics);
+    size_t nodes = 0;
+    for (auto _ : state) {
+        auto ast = Ast{};
+        auto roots = parse(tokens, ast, diagnostics);
+        benchmark::DoNotOptimize(roots);
+        nodes = ast.size();
+    }
+    report(state, program);
+    state.counters["nodes"] = static_cast<double>(nodes);
+}
+
+// Decoding a cached AST, which stands in for lexing and parsing its source.
+// The source still has to be hashed, so that's included.
+auto cache_load_benchmark(benchmark::State& state, CorpusShape shape) -> void {
+    const auto program = generate_corpus(shape);
+    auto diagnostics = Diagnostics{};
+    auto parsed = Ast{};
+    const auto roots = parse(lex(program, diagnostics), parsed, diagnostics);
+    const auto bytes = serialize_ast(parsed, roots, program);
+    for (auto _ : state) {
+        auto ast = Ast{};
+        auto loaded = deserialize_ast(bytes, program, ast);
+        benchmark::DoNotOptimize(loaded);
+    }
+    report(state, program);
+    state.counters["bytes"] = static_cast<double>(bytes.size());
+}
+
+// Scaling of parse_parallel() with the number of threads.
+auto parse_parallel_benchmark(benchmark::State& state) -> void {
+    static const auto program =
+        generate_corpus(CorpusShape{.functions = 65536, .structs = 4096});
+    auto diagnostics = Diagnostics{};
+    static const auto tokens = lex(program, diagnostics);
+    auto pool = ThreadPool{static_cast<size_t>(state.range(0))};
+    for (auto _ : state) {
+        auto ast = Ast{};
+        auto roots = parse_parallel(tokens, ast, diagnostics, pool);
+        benchmark::DoNotOptimize(roots);
+    }
+    report(state, program);
+}
+
+// A single function holding one chain, or one nested call, as deep as the
+// benchmark's argument. Time should grow linearly with the depth.
+auto nesting_shape(const benchmark::State& state, bool calls) -> CorpusShape {
+    const auto depth = static_cast<size_t>(state.range(0));
+    return calls ? CorpusShape{.functions = 1, .call_depth = depth}
+                 : CorpusShape{.functions = 1, .chain_depth = depth};
+}
+
+auto nesting_parse_benchmark(benchmark::State& state, bool calls) -> void {
+    const auto program = generate_corpus(nesting_shape(state, calls));
+    auto diagnostics = Diagnostics{};
+    const auto tokens = lex(program, diagnostics);
+    for (auto _ : state) {
+        auto ast = Ast{};
+        auto roots = parse(tokens, ast, diagnostics);
+        benchmark::DoNotOptimize(roots);
+    }
+    report(state, program);
+    state.SetComplexityN(state.range(0));
+}
+
+// IR compilation and LLVM IR printing together, as chains don't get past the
+// parser.
+auto nesting_compile_benchmark(benchmark::State& state) -> void {
+    const auto program = generate_corpus(nesting_shape(state, true));
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    for (auto _ : state) {
+        auto module = ir::compile(ast, ast[roots], diagnostics);
+        auto text = llvmir::print(module, diagnostics);
+        benchmark::DoNotOptimize(text);
+    }
+    report(state, program);
+    state.SetComplexityN(state.range(0));
+}
+
+auto ir_benchmark(benchmark::State& state, CorpusShape shape) -> void {
+    const auto program = generate_corpus(shape);
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    for (auto _ : state) {
+        auto module = ir::compile(ast, ast[roots], diagnostics);
+        benchmark::DoNotOptimize(module);
+    }
+    report(state, program);
+}
+
+auto llvmir_benchmark(benchmark::State& state, CorpusShape shape) -> void {
+    const auto program = generate_corpus(shape);
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+    for (auto _ : state) {
+        auto text = llvmir::print(module, diagnostics);
+        benchmark::DoNotOptimize(text);
+    }
+    report(state, program);
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(lex_benchmark, functions, shapes::FUNCTIONS);
+BENCHMARK_CAPTURE(lex_benchmark, structs, shapes::STRUCTS);
+BENCHMARK_CAPTURE(lex_benchmark, long_strings, shapes::LONG_STRINGS);
+BENCHMARK_CAPTURE(lex_benchmark, member_chains, shapes::MEMBER_CHAINS);
+
+BENCHMARK_CAPTURE(parse_benchmark, functions, shapes::FUNCTIONS);
+BENCHMARK_CAPTURE(parse_benchmark, structs, shapes::STRUCTS);
+BENCHMARK_CAPTURE(parse_benchmark, long_strings, shapes::LONG_STRINGS);
+BENCHMARK_CAPTURE(parse_benchmark, member_chains, shapes::MEMBER_CHAINS);
+
+BENCHMARK_CAPTURE(cache_load_benchmark, functions, shapes::FUNCTIONS);
+BENCHMARK_CAPTURE(cache_load_benchmark, structs, shapes::STRUCTS);
+BENCHMARK_CAPTURE(cache_load_benchmark, long_strings, shapes::LONG_STRINGS);
+BENCHMARK_CAPTURE(cache_load_benchmark, member_chains, shapes::MEMBER_CHAINS);
+
+BENCHMARK(parse_parallel_benchmark)
+    ->RangeMultiplier(2)
+    ->Range(1, static_cast<int64_t>(ThreadPool::default_thread_count()))
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_CAPTURE(nesting_parse_benchmark, chains, false)
+    ->RangeMultiplier(10)
+    ->Range(100, 100000)
+    ->Complexity(benchmark::oN);
+BENCHMARK_CAPTURE(nesting_parse_benchmark, calls, true)
+    ->RangeMultiplier(10)
+    ->Range(100, 100000)
+    ->Complexity(benchmark::oN);
+BENCHMARK(nesting_compile_benchmark)
+    ->RangeMultiplier(10)
+    ->Range(100, 100000)
+    ->Complexity(benchmark::oN);
+
+// The IR doesn't support member access yet, so chains stop at the parser.
+BENCHMARK_CAPTURE(ir_benchmark, functions, shapes::FUNCTIONS);
+BENCHMARK_CAPTURE(ir_benchmark, structs, shapes::STRUCTS);
+BENCHMARK_CAPTURE(ir_benchmark, long_strings, shapes::LONG_STRINGS);
+
+BENCHMARK_CAPTURE(llvmir_benchmark, functions, shapes::FUNCTIONS);
+BENCHMARK_CAPTURE(llvmir_benchmark, structs, shapes::STRUCTS);
+BENCHMARK_CAPTURE(llvmir_benchmark, long_strings, shapes::LONG_STRINGS);
@@ -0,0 +1,34 @@
+#!/bin/bash
+# Runs every benchmark and writes the results as JSON, one file per benchmark
+# binary, to <output directory>/<commit>/. Extra arguments go to every
+# benchmark, e.g. --benchmark_repetitions=5.
+#
+#   bazel run -c opt //bench:record -- <output directory>
+set -euo pipefail
+
+if [ $# -lt 1 ]; then
+    echo "usage: record.sh <output directory> [benchmark flags...]" >&2
+    exit 1
+fi
+output=$1
+shift
+
+# Under `bazel run` the working directory is the runfiles tree, so relative
+# paths are resolved against the directory the command was started from.
+workspace=${BUILD_WORKSPACE_DIRECTORY:-$PWD}
+case $output in
+/*) ;;
+*) output=$workspace/$output ;;
+esac
+
+commit=$(git -C "$workspace" rev-parse --short HEAD)
+if ! git -C "$workspace" diff --quiet HEAD; then
+    commit=$commit-dirty
+fi
+mkdir -p "$output/$commit"
+
+for benchmark in lexer_benchmark pipeline_benchmark; do
+    "bench/$benchmark" \
+        --benchmark_out="$output/$commit/$benchmark.json" \
+        --benchmark_out_format=json "$@"
+done
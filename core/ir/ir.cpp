@@ -1,145 +1,118 @@
 #include "core/ir/ir.h"
 #include "core/parser/node.h"
 #include "core/util/diagnostics.h"
+#include "core/util/thread_pool.h"
+#include "core/util/trace.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
 #include <memory>
 #include <optional>
+#include <span>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 using namespace xlang;
 using namespace xlang::ir;
 
+auto spelling(Symbol symbol) -> std::string {
+    return std::string{symbol.str()};
+}
+
 auto compile_type(const TypeIdentifier& type_identifier, Module& module,
-                  Diagnostics& diagnostics) -> std::shared_ptr<Type> {
-    if (module.types.contains(type_identifier.full_name())) {
-        return module.types[type_identifier.full_name()];
-    }
-
-    std::shared_ptr<Type> type = nullptr;
-    if (type_identifier.name == "Void") {
-        type = std::make_shared<VoidType>(type_identifier);
-    } else if (type_identifier.name == "Int64") {
-        type = std::make_shared<PrimitiveType>(type_identifier, Primitive::i64);
-    } else if (type_identifier.name == "Int32") {
-        type = std::make_shared<PrimitiveType>(type_identifier, Primitive::i32);
-    } else if (type_identifier.name == "UInt8") {
-        type = std::make_shared<PrimitiveType>(type_identifier, Primitive::i8);
-    } else if (type_identifier.name == "Pointer") {
+                  Diagnostics& diagnostics) -> TypeId {
+    if (type_identifier.name == symbols::POINTER) {
         if (type_identifier.generic_parameters.size() != 1) {
             diagnostics.push_error(
                 "Pointer type can only have one generic parameter, got " +
                     std::to_string(type_identifier.generic_parameters.size()),
                 type_identifier.tokens.name.source);
-            return compile_type(TypeIdentifier::_void(), module, diagnostics);
+            return types::VOID;
         }
-        type = std::make_shared<PointerType>(
-            type_identifier, compile_type(type_identifier.generic_parameters[0],
-                                          module, diagnostics));
+        return module.types.pointer_to(compile_type(
+            type_identifier.generic_parameters[0], module, diagnostics));
     }
 
-    if (!type) {
-        diagnostics.push_error("Unknown type: " + type_identifier.name,
-                               type_identifier.tokens.name.source);
-        return compile_type(TypeIdentifier::_void(), module, diagnostics);
+    if (const auto type = module.types.find(type_identifier.name)) {
+        return type.value();
     }
-
-    module.types[type_identifier.full_name()] = type;
-    return type;
+    diagnostics.push_error("Unknown type: " + spelling(type_identifier.name),
+                           type_identifier.tokens.name.source);
+    return types::VOID;
 }
 
-auto compile_struct_definition(const StructDefinition& struct_definition,
-                               Module& module, Diagnostics& diagnostics)
-    -> std::shared_ptr<IRNode> {
-    auto fields = std::unordered_map<std::string, std::shared_ptr<Type>>{};
-    auto functions =
-        std::unordered_map<std::string, std::shared_ptr<Function>>{};
+auto declare_struct(const Ast& ast, const StructDefinition& struct_definition,
+                    Module& module, Diagnostics& diagnostics) -> void {
+    auto fields = std::unordered_map<Symbol, TypeId>{};
+    auto functions = std::unordered_map<Symbol, std::shared_ptr<Function>>{};
 
     // TODO: rename to field
-    for (const auto& member : struct_definition.members) {
+    for (const auto& member : ast[struct_definition.members]) {
         fields[member.name] = compile_type(member.type, module, diagnostics);
     }
 
-    const auto struct_type_identifier =
-        TypeIdentifier{struct_definition.name,
-                       std::vector<TypeIdentifier>{},
-                       {
-                           struct_definition.tokens.identifier,
-                           std::nullopt,
-                           std::nullopt,
-                       }};
-    module.types[struct_type_identifier.full_name()] =
-        std::make_shared<StructType>(struct_type_identifier, fields, functions);
-    return nullptr;
+    module.types.add_struct(std::make_unique<StructType>(
+        struct_definition.name, std::move(fields), std::move(functions)));
 }
 
-auto compile_node(const Node& node, Module& module, Diagnostics& diagnostics)
-    -> std::shared_ptr<IRNode>;
-
-auto compile_function_definition(const FunctionDefinition& function_definition,
-                                 Module& module, Diagnostics& diagnostics)
-    -> std::shared_ptr<IRNode> {
+// Adds the signature of `function_definition` to `module`, with the body left
+// to lower_function().
+auto declare_function(const Ast& ast,
+                      const FunctionDefinition& function_definition,
+                      Module& module, Diagnostics& diagnostics)
+    -> std::shared_ptr<Function> {
     auto parameters = std::vector<Function::Parameter>{};
-    auto body = std::vector<std::shared_ptr<IRNode>>{};
-
-    for (const auto& parameter : function_definition.parameters) {
+    parameters.reserve(function_definition.parameters.size());
+    for (const auto& parameter : ast[function_definition.parameters]) {
         parameters.emplace_back(
             parameter.name, compile_type(parameter.type, module, diagnostics));
     }
 
-    const auto return_type_identifier =
-        function_definition.return_type.value_or(
-            TypeIdentifier{"Void",
-                           {},
-                           {function_definition.tokens.identifier, std::nullopt,
-                            std::nullopt}});
-
     const auto return_type =
-        compile_type(return_type_identifier, module, diagnostics);
+        function_definition.return_type.has_value()
+            ? compile_type(function_definition.return_type.value(), module,
+                           diagnostics)
+            : types::VOID;
 
-    for (const auto& statement : function_definition.body) {
-        body.push_back(compile_node(statement, module, diagnostics));
-    }
+    auto function = std::make_shared<Function>(
+        function_definition.name, function_definition.external,
+        function_definition.variadic, std::move(parameters), return_type,
+        std::vector<std::shared_ptr<IRNode>>{}, nullptr);
+    module.functions[function_definition.name] = function;
+    return function;
+}
 
-    std::shared_ptr<IRNode> return_value = nullptr;
-    if (function_definition.return_value) {
-        return_value = compile_node(*function_definition.return_value, module,
-                                    diagnostics);
-    }
+auto compile_node(const Ast& ast, NodeId id, const Module& module,
+                  Diagnostics& diagnostics) -> std::shared_ptr<IRNode>;
 
-    if (return_value && return_value->type != return_type) {
-        diagnostics.push_error("Function " + function_definition.name +
-                                   " expects a return value of type " +
-                                   return_type->identifier.full_name() +
-                                   ", got " +
-                                   return_value->type->identifier.full_name(),
-                               function_definition.tokens.identifier.source);
-        return nullptr;
-    }
+namespace {
 
-    if (return_value && return_type->identifier.name == "Void") {
-        diagnostics.push_error("Function " + function_definition.name +
-                                   " expects no return value, got one",
-                               function_definition.tokens.identifier.source);
-        return nullptr;
-    }
+// A call whose arguments are still being compiled.
+struct PendingCall {
+    const FunctionCall* function_call;
+    std::shared_ptr<Function> function;
+    std::span<const NodeId> argument_ids;
+    std::vector<std::shared_ptr<IRNode>> arguments;
+};
 
-    module.functions[function_definition.name] = std::make_shared<Function>(
-        function_definition.name, function_definition, parameters, return_type,
-        body, return_value);
-    return nullptr;
-}
+} // namespace
 
-auto compile_function_call(const FunctionCall& function_call, Module& module,
-                           Diagnostics& diagnostics)
-    -> std::shared_ptr<IRNode> {
-    if (!module.functions.contains(function_call.name)) {
-        diagnostics.push_error("Unknown function: " + function_call.name,
+auto start_function_call(const Ast& ast, const FunctionCall& function_call,
+                         const Module& module, Diagnostics& diagnostics)
+    -> std::optional<PendingCall> {
+    const auto it = module.functions.find(function_call.name);
+    if (it == module.functions.end()) {
+        diagnostics.push_error("Unknown function: " +
+                                   spelling(function_call.name),
                                function_call.tokens.identifier.source);
-        return nullptr;
+        return std::nullopt;
     }
 
-    const auto& function = module.functions[function_call.name];
+    const auto& function = it->second;
 
     bool call_size_compatible = false;
-    if (function->definition.variadic) {
+    if (function->variadic) {
         call_size_compatible =
             function_call.arguments.size() >= function->parameters.size();
     } else {
@@ -149,87 +122,373 @@ auto compile_function_call(const FunctionCall& function_call, Module& module,
 
     if (!call_size_compatible) {
         diagnostics.push_error(
-            "Function " + function_call.name + " expects " +
+            "Function " + spelling(function_call.name) + " expects " +
                 std::to_string(function->parameters.size()) +
                 " arguments, got " +
                 std::to_string(function_call.arguments.size()),
             function_call.tokens.identifier.source);
+        return std::nullopt;
+    }
+
+    return PendingCall{&function_call, function, ast[function_call.arguments],
+                       {}};
+}
+
+// Adds the next argument to `call`. Returns false, failing the call, if the
+// argument couldn't be compiled or has the wrong type.
+auto add_argument(PendingCall& call, std::shared_ptr<IRNode> argument,
+                  const Module& module, Diagnostics& diagnostics) -> bool {
+    const auto& function_call = *call.function_call;
+    const auto& function = *call.function;
+    const auto i = call.arguments.size();
+    if (!argument) {
+        diagnostics.push_error("Function " + spelling(function_call.name) +
+                                   " argument " + std::to_string(i) +
+                                   " could not be compiled",
+                               function_call.tokens.paren_open.source);
+        return false;
+    }
+
+    if (i < function.parameters.size() &&
+        function.parameters[i].type != argument->type) {
+        diagnostics.push_error(
+            "Function " + spelling(function_call.name) +
+                " expects argument " + std::to_string(i) + " to be of type " +
+                module.types.full_name(function.parameters[i].type) +
+                ", got " + module.types.full_name(argument->type),
+            function_call.tokens.identifier.source);
+        return false;
+    }
+    call.arguments.push_back(std::move(argument));
+    return true;
+}
+
+// Arguments can nest calls as deep as the parser allows, so nested calls
+// wait on an explicit stack rather than being compiled recursively.
+auto compile_function_call(const Ast& ast, const FunctionCall& function_call,
+                           const Module& module, Diagnostics& diagnostics)
+    -> std::shared_ptr<IRNode> {
+    auto calls = std::vector<PendingCall>{};
+    auto outermost =
+        start_function_call(ast, function_call, module, diagnostics);
+    if (!outermost.has_value()) {
         return nullptr;
     }
+    calls.push_back(std::move(outermost.value()));
 
-    std::vector<std::shared_ptr<IRNode>> arguments;
+    while (true) {
+        auto& call = calls.back();
+        std::shared_ptr<IRNode> result = nullptr;
+        if (call.arguments.size() < call.argument_ids.size()) {
+            const auto id = call.argument_ids[call.arguments.size()];
+            if (id.type == NodeType::function_call) {
+                auto nested = start_function_call(
+                    ast, ast.get<FunctionCall>(id), module, diagnostics);
+                if (nested.has_value()) {
+                    calls.push_back(std::move(nested.value()));
+                    continue;
+                }
+            } else {
+                result = compile_node(ast, id, module, diagnostics);
+            }
+        } else {
+            result = std::make_shared<FunctionCallIRNode>(
+                call.function->return_type, call.function,
+                std::move(call.arguments));
+            calls.pop_back();
+            if (calls.empty()) {
+                return result;
+            }
+        }
 
-    for (size_t i = 0; i < function_call.arguments.size(); ++i) {
-        const auto& argument =
-            compile_node(function_call.arguments[i], module, diagnostics);
-        if (!argument) {
-            diagnostics.push_error("Function " + function_call.name +
-                                       " argument " + std::to_string(i) +
-                                       " could not be compiled",
-                                   function_call.tokens.paren_open.source);
-            return nullptr;
+        // A failed argument fails its call, which fails the call it's an
+        // argument of, and so on.
+        while (!add_argument(calls.back(), std::move(result), module,
+                             diagnostics)) {
+            calls.pop_back();
+            if (calls.empty()) {
+                return nullptr;
+            }
+            result = nullptr;
         }
+    }
+}
 
-        arguments.push_back(argument);
-        if (i >= function->parameters.size()) {
+// Definitions are only compiled at the top level, by declare().
+auto compile_node(const Ast& ast, NodeId id, const Module& module,
+                  Diagnostics& diagnostics) -> std::shared_ptr<IRNode> {
+    return visit(
+        ast, id,
+        Overloaded{
+            [&](const FunctionCall& function_call) {
+                return compile_function_call(ast, function_call, module,
+                                             diagnostics);
+            },
+            [&](const StringLiteral& string_literal)
+                -> std::shared_ptr<IRNode> {
+                return std::make_shared<StringLiteralIRNode>(
+                    string_literal, types::UINT8_POINTER);
+            },
+            [&](const IntegerLiteral& integer_literal)
+                -> std::shared_ptr<IRNode> {
+                return std::make_shared<IntegerLiteralIRNode>(
+                    integer_literal, types::INT32);
+            },
+            [&](const auto& /*node*/) -> std::shared_ptr<IRNode> {
+                diagnostics.push_error("Unexpected node type: " +
+                                           NodeType_to_string(id.type),
+                                       node_source(ast, id));
+                return nullptr;
+            },
+        });
+}
+
+// What lowering one top-level node produced, kept apart from what the others
+// produced until they're all done.
+struct Lowered {
+    std::vector<std::shared_ptr<IRNode>> body;
+    std::shared_ptr<IRNode> return_value;
+    bool valid = true;
+    Diagnostics diagnostics;
+};
+
+// Whether anything `lowered` produced calls one of `functions`.
+auto calls_any(const Lowered& lowered,
+               const std::unordered_set<const Function*>& functions) -> bool {
+    auto nodes = std::vector<const IRNode*>{};
+    for (const auto& statement : lowered.body) {
+        nodes.push_back(statement.get());
+    }
+    nodes.push_back(lowered.return_value.get());
+    while (!nodes.empty()) {
+        const auto* const node = nodes.back();
+        nodes.pop_back();
+        if (node == nullptr || node->kind != IRNodeKind::function_call) {
             continue;
         }
-        const auto& parameter = function->parameters[i];
-        if (parameter.type != argument->type) {
-            diagnostics.push_error(
-                "Function " + function_call.name + " expects argument " +
-                    std::to_string(i) + " to be of type " +
-                    parameter.type->identifier.full_name() + ", got " +
-                    argument->type->identifier.full_name(),
-                function_call.tokens.identifier.source);
+        const auto& call = static_cast<const FunctionCallIRNode&>(*node);
+        if (functions.contains(call.function.get())) {
+            return true;
+        }
+        for (const auto& argument : call.arguments) {
+            nodes.push_back(argument.get());
         }
     }
+    return false;
+}
+
+auto lower_function(const Ast& ast,
+                    const FunctionDefinition& function_definition,
+                    const Function& function, const Module& module,
+                    Lowered& lowered) -> void {
+    auto& diagnostics = lowered.diagnostics;
+    lowered.body.reserve(function_definition.body.size());
+    for (const auto statement : ast[function_definition.body]) {
+        lowered.body.push_back(
+            compile_node(ast, statement, module, diagnostics));
+    }
 
-    return std::make_shared<FunctionCallIRNode>(function->return_type, function,
-                                                arguments);
+    if (function_definition.return_value.has_value()) {
+        lowered.return_value = compile_node(
+            ast, function_definition.return_value.value(), module, diagnostics);
+    }
+
+    const auto& return_value = lowered.return_value;
+    if (return_value && return_value->type != function.return_type) {
+        diagnostics.push_error(
+            "Function " + spelling(function_definition.name) +
+                " expects a return value of type " +
+                module.types.full_name(function.return_type) + ", got " +
+                module.types.full_name(return_value->type),
+            function_definition.tokens.identifier.source);
+        lowered.valid = false;
+        return;
+    }
+
+    if (return_value && function.return_type == types::VOID) {
+        diagnostics.push_error("Function " +
+                                   spelling(function_definition.name) +
+                                   " expects no return value, got one",
+                               function_definition.tokens.identifier.source);
+        lowered.valid = false;
+    }
 }
 
-auto compile_node(const Node& node, Module& module, Diagnostics& diagnostics)
-    -> std::shared_ptr<IRNode> {
-    switch (node.type) {
-    case NodeType::struct_definition:
-        return compile_struct_definition(std::get<StructDefinition>(node.value),
-                                         module, diagnostics);
-    case NodeType::function_definition:
-        return compile_function_definition(
-            std::get<FunctionDefinition>(node.value), module, diagnostics);
-    case NodeType::function_call:
-        return compile_function_call(std::get<FunctionCall>(node.value), module,
-                                     diagnostics);
-
-    case NodeType::string_literal: {
-        const auto& string_literal = std::get<StringLiteral>(node.value);
-        return std::make_shared<StringLiteralIRNode>(
-            string_literal,
-            compile_type(TypeIdentifier::pointer_to(TypeIdentifier::uint8()),
-                         module, diagnostics));
-    }
-    case NodeType::integer_literal: {
-        const auto& integer_literal = std::get<IntegerLiteral>(node.value);
-        return std::make_shared<IntegerLiteralIRNode>(
-            integer_literal,
-            compile_type(TypeIdentifier::int32(), module, diagnostics));
-    }
-    default:
-        diagnostics.push_error("Unexpected node type: " +
-                                   NodeType_to_string(node.type),
-                               node_source(node));
-        return nullptr;
+// Registers every type and function signature among `roots`, so that bodies
+// can refer to them wherever they're defined. Structs come first, since
+// signatures can name them. Returns the function declared by each root, or
+// null for roots that don't declare one.
+auto declare(const Ast& ast, std::span<const NodeId> roots, Module& module,
+             Diagnostics& diagnostics)
+    -> std::vector<std::shared_ptr<Function>> {
+    for (const auto root : roots) {
+        if (root.type == NodeType::struct_definition) {
+            declare_struct(ast, ast.get<StructDefinition>(root), module,
+                           diagnostics);
+        }
+    }
+
+    auto functions = std::vector<std::shared_ptr<Function>>(roots.size());
+    for (size_t i = 0; i < roots.size(); ++i) {
+        if (roots[i].type == NodeType::function_definition) {
+            functions[i] = declare_function(
+                ast, ast.get<FunctionDefinition>(roots[i]), module,
+                diagnostics);
+        }
     }
+    return functions;
+}
+
+TypeTable::TypeTable() {
+    add(std::make_unique<VoidType>());
+    add(std::make_unique<PrimitiveType>(symbols::UINT8, Primitive::i8));
+    add(std::make_unique<PrimitiveType>(symbols::INT32, Primitive::i32));
+    add(std::make_unique<PrimitiveType>(symbols::INT64, Primitive::i64));
+    [[maybe_unused]] const auto uint8_pointer = pointer_to(types::UINT8);
+    assert(find(symbols::INT64) == types::INT64);
+    assert(uint8_pointer == types::UINT8_POINTER);
 }
 
-auto xlang::ir::compile(Buffer<std::vector<xlang::Node>> ast,
+auto TypeTable::find(Symbol name) const -> std::optional<TypeId> {
+    if (const auto it = named.find(name); it != named.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+auto TypeTable::pointer_to(TypeId pointee) -> TypeId {
+    if (const auto it = pointers.find(pointee.index); it != pointers.end()) {
+        return it->second;
+    }
+    const auto id = add(std::make_unique<PointerType>(pointee));
+    pointers.emplace(pointee.index, id);
+    return id;
+}
+
+auto TypeTable::add_struct(std::unique_ptr<StructType> type) -> TypeId {
+    return add(std::move(type));
+}
+
+auto TypeTable::add(std::unique_ptr<Type> type) -> TypeId {
+    const auto id = TypeId{static_cast<uint32_t>(types.size())};
+    if (type->name != symbols::POINTER) {
+        named[type->name] = id;
+    }
+    types.push_back(std::move(type));
+    return id;
+}
+
+auto TypeTable::full_name(TypeId id) const -> std::string {
+    // Pointers are the only generic types, so this is a named type inside
+    // some number of them.
+    auto name = std::string{};
+    size_t depth = 0;
+    while ((*this)[id].kind == TypeKind::pointer_type) {
+        name += "Pointer<";
+        ++depth;
+        id = static_cast<const PointerType&>((*this)[id]).pointee;
+    }
+    name += (*this)[id].name.str();
+    name.append(depth, '>');
+    return name;
+}
+
+FunctionCallIRNode::~FunctionCallIRNode() {
+    auto nodes = std::move(arguments);
+    while (!nodes.empty()) {
+        auto node = std::move(nodes.back());
+        nodes.pop_back();
+        if (node && node->kind == IRNodeKind::function_call &&
+            node.use_count() == 1) {
+            auto* const call = static_cast<FunctionCallIRNode*>(node.get());
+            std::move(call->arguments.begin(), call->arguments.end(),
+                      std::back_inserter(nodes));
+            call->arguments.clear();
+        }
+    }
+}
+
+Module::~Module() {
+    for (auto& [name, function] : functions) {
+        function->body.clear();
+        function->return_value = nullptr;
+    }
+}
+
+auto xlang::ir::compile(const Ast& ast, std::span<const NodeId> roots,
                         Diagnostics& diagnostics) -> Module {
+    auto pool = ThreadPool{1};
+    return compile_parallel(ast, roots, diagnostics, pool);
+}
+
+auto xlang::ir::compile_parallel(const Ast& ast,
+                                 std::span<const NodeId> roots,
+                                 Diagnostics& diagnostics, ThreadPool& pool)
+    -> Module {
     auto module = Module{};
+    auto functions = declare(ast, roots, module, diagnostics);
+
+    // The module is only read from here on, so roots lower independently.
+    // Top-level expressions are lowered just for their diagnostics.
+    XLANG_TRACE(ir, info,
+                "Lowering " << roots.size() << " declarations on "
+                            << pool.size() << " threads");
+    auto lowered = std::vector<Lowered>(roots.size());
+    const auto lower = [&](size_t i) {
+        const auto root = roots[i];
+        lowered[i] = Lowered{};
+        if (functions[i]) {
+            lower_function(ast, ast.get<FunctionDefinition>(root),
+                           *functions[i], module, lowered[i]);
+        } else if (root.type != NodeType::struct_definition) {
+            lowered[i].body.push_back(
+                compile_node(ast, root, module, lowered[i].diagnostics));
+        }
+    };
+    pool.for_each(roots.size(), lower);
+
+    // A function whose return value doesn't check isn't compiled. Calls to
+    // it were lowered against its declaration, so whatever made them is
+    // lowered again without it, which fails those calls. Dropping a call
+    // never makes a return value mistyped, so no more functions are
+    // dropped by that.
+    auto invalid = std::unordered_set<const Function*>{};
+    for (size_t i = 0; i < roots.size(); ++i) {
+        const auto& function = functions[i];
+        if (!function || lowered[i].valid) {
+            continue;
+        }
+        invalid.insert(function.get());
+        const auto it = module.functions.find(function->name);
+        if (it != module.functions.end() && it->second == function) {
+            module.functions.erase(it);
+        }
+    }
+    if (!invalid.empty()) {
+        auto callers = std::vector<size_t>{};
+        for (size_t i = 0; i < roots.size(); ++i) {
+            if (lowered[i].valid && calls_any(lowered[i], invalid)) {
+                callers.push_back(i);
+            }
+        }
+        XLANG_TRACE(ir, info,
+                    "Lowering " << callers.size()
+                                << " declarations again without "
+                                << invalid.size() << " invalid functions");
+        pool.for_each(callers.size(),
+                      [&](size_t caller) { lower(callers[caller]); });
+    }
 
-    while (!ast.empty()) {
-        const auto node = ast.pop();
-        compile_node(node, module, diagnostics);
+    for (size_t i = 0; i < roots.size(); ++i) {
+        for (auto& diagnostic : lowered[i].diagnostics) {
+            diagnostics.push(std::move(diagnostic));
+        }
+        auto& function = functions[i];
+        if (!function || !lowered[i].valid) {
+            continue;
+        }
+        function->body = std::move(lowered[i].body);
+        function->return_value = std::move(lowered[i].return_value);
     }
     return module;
-}
\ No newline at end of file
+}
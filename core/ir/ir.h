@@ -1,16 +1,46 @@
 #pragma once
 
 #include "core/parser/node.h"
-#include "core/util/buffer.h"
 #include "core/util/diagnostics.h"
 #include "core/util/enum.h"
+#include "core/util/symbol.h"
+#include "core/util/thread_pool.h"
+#include <cassert>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace xlang::ir {
 
+// A type in a Module's TypeTable. Types are interned, so two TypeIds of the
+// same module are equal exactly when the types are.
+struct TypeId {
+    uint32_t index = 0;
+
+    auto operator==(const TypeId& other) const -> bool = default;
+};
+
+// Types every module has. They're registered up front, in this order, so each
+// has a fixed ID.
+namespace types {
+
+constexpr auto VOID = TypeId{0};
+constexpr auto UINT8 = TypeId{1};
+constexpr auto INT32 = TypeId{2};
+constexpr auto INT64 = TypeId{3};
+// The type of string literals.
+constexpr auto UINT8_POINTER = TypeId{4};
+
+} // namespace types
+
+// Which subclass a Type is, for visit() to dispatch on.
+ENUM_CLASS(TypeKind, void_type, primitive_type, pointer_type, struct_type);
+
 class Type {
   public:
     Type(const Type&) = default;
@@ -19,29 +49,37 @@ class Type {
     auto operator=(Type&&) -> Type& = delete;
     virtual ~Type() = default;
 
-    Type(TypeIdentifier _identifier) : identifier{std::move(_identifier)} {}
-    TypeIdentifier identifier;
+    Type(TypeKind _kind, Symbol _name) : kind{_kind}, name{_name} {}
+    TypeKind kind;
+    // The name without generic parameters, e.g. Pointer for Pointer<UInt8>.
+    Symbol name;
 };
 
 class VoidType : public Type {
   public:
-    VoidType(TypeIdentifier _identifier) : Type(std::move(_identifier)) {}
+    static constexpr auto KIND = TypeKind::void_type;
+
+    VoidType() : Type(KIND, symbols::VOID) {}
 };
 
 ENUM_CLASS(Primitive, u8, u16, u32, u64, i8, i16, i32, i64, f32, f64);
 
 class PrimitiveType : public Type {
   public:
-    PrimitiveType(TypeIdentifier _identifier, Primitive _primitive)
-        : Type(std::move(_identifier)), primitive{_primitive} {}
+    static constexpr auto KIND = TypeKind::primitive_type;
+
+    PrimitiveType(Symbol _name, Primitive _primitive)
+        : Type(KIND, _name), primitive{_primitive} {}
     Primitive primitive;
 };
 
 class PointerType : public Type {
   public:
-    PointerType(TypeIdentifier _identifier, std::shared_ptr<Type> pointee)
-        : Type(std::move(_identifier)), pointee(std::move(pointee)) {}
-    std::shared_ptr<Type> pointee;
+    static constexpr auto KIND = TypeKind::pointer_type;
+
+    explicit PointerType(TypeId _pointee)
+        : Type(KIND, symbols::POINTER), pointee{_pointee} {}
+    TypeId pointee;
 };
 
 class IRNode;
@@ -50,36 +88,38 @@ class Function {
   public:
     class Parameter {
       public:
-        Parameter(std::string _name, std::shared_ptr<Type> _type)
-            : name{std::move(_name)}, type{std::move(_type)} {}
-        std::string name;
-        std::shared_ptr<Type> type;
+        Parameter(Symbol _name, TypeId _type) : name{_name}, type{_type} {}
+        Symbol name;
+        TypeId type;
     };
-    Function(std::string _name, FunctionDefinition _definition,
-             std::vector<Parameter> _parameters,
-             std::shared_ptr<Type> _return_type,
+    Function(Symbol _name, bool _external, bool _variadic,
+             std::vector<Parameter> _parameters, TypeId _return_type,
              std::vector<std::shared_ptr<IRNode>> _body,
              std::shared_ptr<IRNode> _return_value)
-        : name{std::move(_name)}, definition{std::move(_definition)},
-          parameters{std::move(_parameters)},
-          return_type{std::move(_return_type)}, body{std::move(_body)},
-          return_value{std::move(_return_value)} {}
-    std::string name;
-    FunctionDefinition definition;
+        : name{_name}, external{_external}, variadic{_variadic},
+          parameters{std::move(_parameters)}, return_type{_return_type},
+          body{std::move(_body)}, return_value{std::move(_return_value)} {}
+    Symbol name;
+    bool external;
+    bool variadic;
     std::vector<Parameter> parameters;
-    std::shared_ptr<Type> return_type;
+    TypeId return_type;
     std::vector<std::shared_ptr<IRNode>> body;
     std::shared_ptr<IRNode> return_value;
 };
 
+// Which subclass an IRNode is, for visit() to dispatch on.
+ENUM_CLASS(IRNodeKind, function_call, string_literal, integer_literal);
+
 class IRNode {
   public:
     IRNode(const IRNode&) = default;
     IRNode(IRNode&&) = delete;
     virtual ~IRNode() = default;
-    IRNode(std::shared_ptr<Type> _type) : type{std::move(_type)} {}
+    IRNode(IRNodeKind _kind, TypeId _type) : kind{_kind}, type{_type} {}
 
-    std::shared_ptr<Type> type;
+    IRNodeKind kind;
+    TypeId type;
 
     auto operator=(const IRNode&) -> IRNode& = default;
     auto operator=(IRNode&&) -> IRNode& = delete;
@@ -87,52 +127,145 @@ class IRNode {
 
 class FunctionCallIRNode : public IRNode {
   public:
-    FunctionCallIRNode(std::shared_ptr<Type> _type,
-                       std::shared_ptr<Function> _function,
+    static constexpr auto KIND = IRNodeKind::function_call;
+
+    FunctionCallIRNode(TypeId _type, std::shared_ptr<Function> _function,
                        std::vector<std::shared_ptr<IRNode>> _arguments)
-        : IRNode{std::move(_type)}, function{std::move(_function)},
+        : IRNode{KIND, _type}, function{std::move(_function)},
           arguments{std::move(_arguments)} {}
+    FunctionCallIRNode(const FunctionCallIRNode&) = default;
+    FunctionCallIRNode(FunctionCallIRNode&&) = delete;
+    auto operator=(const FunctionCallIRNode&) -> FunctionCallIRNode& = default;
+    auto operator=(FunctionCallIRNode&&) -> FunctionCallIRNode& = delete;
+    // Releases nested calls one at a time rather than recursively.
+    ~FunctionCallIRNode() override;
+
     std::shared_ptr<Function> function;
     std::vector<std::shared_ptr<IRNode>> arguments;
 };
 
 class StringLiteralIRNode : public IRNode {
   public:
-    StringLiteralIRNode(StringLiteral _value, std::shared_ptr<Type> _type)
-        : IRNode{std::move(_type)}, value{std::move(_value)} {}
+    static constexpr auto KIND = IRNodeKind::string_literal;
+
+    StringLiteralIRNode(StringLiteral _value, TypeId _type)
+        : IRNode{KIND, _type}, value{std::move(_value)} {}
     StringLiteral value;
 };
 
 class IntegerLiteralIRNode : public IRNode {
   public:
-    IntegerLiteralIRNode(IntegerLiteral _value, std::shared_ptr<Type> _type)
-        : IRNode{std::move(_type)}, value{std::move(_value)} {}
+    static constexpr auto KIND = IRNodeKind::integer_literal;
+
+    IntegerLiteralIRNode(IntegerLiteral _value, TypeId _type)
+        : IRNode{KIND, _type}, value{std::move(_value)} {}
     IntegerLiteral value;
 };
 
 class StructType : public Type {
   public:
-    StructType(
-        TypeIdentifier _identifier,
-        std::unordered_map<std::string, std::shared_ptr<Type>> _fields,
-        std::unordered_map<std::string, std::shared_ptr<Function>> _functions)
-        : Type(std::move(_identifier)), fields{std::move(_fields)},
+    static constexpr auto KIND = TypeKind::struct_type;
+
+    StructType(Symbol _name, std::unordered_map<Symbol, TypeId> _fields,
+               std::unordered_map<Symbol, std::shared_ptr<Function>> _functions)
+        : Type(KIND, _name), fields{std::move(_fields)},
           functions{std::move(_functions)} {}
-    std::unordered_map<std::string, std::shared_ptr<Type>> fields;
-    std::unordered_map<std::string, std::shared_ptr<Function>> functions;
+    std::unordered_map<Symbol, TypeId> fields;
+    std::unordered_map<Symbol, std::shared_ptr<Function>> functions;
+};
+
+// Calls `visitor` with `type` as its own class and returns what it returns,
+// e.g.
+//     visit(type, Overloaded{[](const PointerType&) {...}, ...});
+template <typename Visitor>
+auto visit(const Type& type, Visitor&& visitor) -> decltype(auto) {
+    switch (type.kind) {
+    case TypeKind::void_type:
+        return visitor(static_cast<const VoidType&>(type));
+    case TypeKind::primitive_type:
+        return visitor(static_cast<const PrimitiveType&>(type));
+    case TypeKind::pointer_type:
+        return visitor(static_cast<const PointerType&>(type));
+    case TypeKind::struct_type:
+        return visitor(static_cast<const StructType&>(type));
+    case TypeKind::count:
+        break;
+    }
+    assert(false && "invalid type kind");
+    std::unreachable();
+}
+
+// Calls `visitor` with `node` as its own class and returns what it returns.
+template <typename Visitor>
+auto visit(const IRNode& node, Visitor&& visitor) -> decltype(auto) {
+    switch (node.kind) {
+    case IRNodeKind::function_call:
+        return visitor(static_cast<const FunctionCallIRNode&>(node));
+    case IRNodeKind::string_literal:
+        return visitor(static_cast<const StringLiteralIRNode&>(node));
+    case IRNodeKind::integer_literal:
+        return visitor(static_cast<const IntegerLiteralIRNode&>(node));
+    case IRNodeKind::count:
+        break;
+    }
+    assert(false && "invalid IR node kind");
+    std::unreachable();
+}
+
+// Every type of a module, each stored once. Types are found by their
+// structure, pointers by their pointee and the rest by name, so building the
+// same type twice gives the same TypeId.
+class TypeTable {
+  public:
+    TypeTable();
+
+    // The builtin or struct called `name`, if there is one.
+    [[nodiscard]] auto find(Symbol name) const -> std::optional<TypeId>;
+
+    auto pointer_to(TypeId pointee) -> TypeId;
+
+    // Adds a struct. A struct with the name of an existing type replaces it
+    // from then on; IDs already handed out still refer to the old type.
+    auto add_struct(std::unique_ptr<StructType> type) -> TypeId;
+
+    [[nodiscard]] auto operator[](TypeId id) const -> const Type& {
+        return *types[id.index];
+    }
+
+    // The name as written in source, e.g. Pointer<UInt8>.
+    [[nodiscard]] auto full_name(TypeId id) const -> std::string;
+
+    [[nodiscard]] auto size() const -> size_t { return types.size(); }
+
+  private:
+    auto add(std::unique_ptr<Type> type) -> TypeId;
+
+    std::vector<std::unique_ptr<Type>> types;
+    std::unordered_map<Symbol, TypeId> named;
+    // Keyed by the pointee's index.
+    std::unordered_map<uint32_t, TypeId> pointers;
 };
 
 class Module {
   public:
-    std::unordered_map<std::string, std::shared_ptr<Type>> types;
-    std::unordered_map<std::string, std::shared_ptr<Function>> functions;
+    Module() = default;
+    Module(const Module&) = delete;
+    Module(Module&&) = default;
+    auto operator=(const Module&) -> Module& = delete;
+    auto operator=(Module&&) -> Module& = default;
+    // Functions that call each other own each other through their bodies, so
+    // the bodies are released first.
+    ~Module();
+
+    TypeTable types;
+    std::unordered_map<Symbol, std::shared_ptr<Function>> functions;
 };
 
 inline auto operator<<(std::ostream& os, const Module& module)
     -> std::ostream& {
     os << "Module(types:";
-    for (const auto& [name, type] : module.types) {
-        os << name << ",";
+    for (uint32_t i = 0; i < module.types.size(); ++i) {
+        os << module.types.full_name(TypeId{i}) << ",";
     }
     os << ";functions:";
     for (const auto& [name, function] : module.functions) {
@@ -142,7 +275,15 @@ inline auto operator<<(std::ostream& os, const Module& module)
     return os;
 }
 
-auto compile(Buffer<std::vector<xlang::Node>> ast, Diagnostics& diagnostics)
-    -> Module;
+// Compiles the declarations `roots` of `ast`. Every struct and function
+// signature is declared before any function body is lowered, so bodies can
+// use functions defined after them.
+auto compile(const Ast& ast, std::span<const NodeId> roots,
+             Diagnostics& diagnostics) -> Module;
+
+// Like compile(), but lowers the function bodies concurrently on `pool`. The
+// module and the diagnostics are the same as compile()'s.
+auto compile_parallel(const Ast& ast, std::span<const NodeId> roots,
+                      Diagnostics& diagnostics, ThreadPool& pool) -> Module;
 
 } // namespace xlang::ir
\ No newline at end of file
@@ -0,0 +1,437 @@
+#include "ir.h"
+#include "passes.h"
+#include "core/lexer/lexer.h"
+#include "core/parser/parser.h"
+#include "core/util/allocation_counter.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace xlang;
+
+namespace {
+
+auto nested_type(size_t depth) -> std::string {
+    auto type = std::string{"UInt8"};
+    for (size_t i = 0; i < depth; ++i) {
+        type = "Pointer<" + type + ">";
+    }
+    return "extern fn f(value: " + type + ")\n";
+}
+
+auto nested_call(size_t depth) -> std::string {
+    auto program = std::string{"extern fn f(value: Int32) -> Int32\n"
+                               "fn main() {\n"};
+    for (size_t i = 0; i < depth; ++i) {
+        program += "f(";
+    }
+    return program + "1" + std::string(depth, ')') + "\n}\n";
+}
+
+auto parse_allocations(const std::string& program) -> size_t {
+    auto diagnostics = Diagnostics{};
+    const auto tokens = lex(program, diagnostics);
+    auto ast = Ast{};
+    const auto before = allocation_count();
+    parse(tokens, ast, diagnostics);
+    const auto allocations = allocation_count() - before;
+    EXPECT_EQ(diagnostics.size(), 0);
+    return allocations;
+}
+
+auto compile_allocations(const std::string& program) -> size_t {
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto before = allocation_count();
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+    const auto allocations = allocation_count() - before;
+    EXPECT_EQ(diagnostics.size(), 0);
+    return allocations;
+}
+
+// Allocations made by a vector growing to `size` elements one at a time, as
+// the stack of calls waiting on their arguments does.
+auto stack_allocations(size_t size) -> size_t {
+    auto stack = std::vector<size_t>{};
+    const auto before = allocation_count();
+    for (size_t i = 0; i < size; ++i) {
+        stack.push_back(i);
+    }
+    return allocation_count() - before;
+}
+
+} // namespace
+
+// Subtrees are handed from stage to stage by move or by reference, so every
+// extra level of nesting costs the same fixed number of allocations. A copy
+// anywhere along the way would also copy everything below it.
+TEST(IRTest, TestPipelineDoesNotCopySubtrees) {
+    // Warms up state that's set up on first use, such as output streams.
+    parse_allocations(nested_type(0));
+    compile_allocations(nested_call(0));
+
+    for (size_t depth = 1; depth < 32; ++depth) {
+        // The generic parameter list of the new level.
+        EXPECT_EQ(parse_allocations(nested_type(depth + 1)),
+                  parse_allocations(nested_type(depth)) + 1);
+        // The call's IR node and its argument list, plus whatever it takes
+        // the stack of pending calls to grow by one.
+        EXPECT_EQ(compile_allocations(nested_call(depth + 1)),
+                  compile_allocations(nested_call(depth)) + 2 +
+                      stack_allocations(depth + 1) -
+                      stack_allocations(depth));
+    }
+}
+
+TEST(IRTest, TestDeepNesting) {
+    const auto program = nested_call(100000);
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    {
+        auto module = ir::compile(ast, ast[roots], diagnostics);
+        ASSERT_EQ(module.functions.size(), 2);
+        ir::PassManager{}.run(module);
+        ASSERT_EQ(module.functions.size(), 2);
+    }
+    ASSERT_EQ(diagnostics.size(), 0);
+}
+
+TEST(IRTest, TestTypesAreInterned) {
+    auto types = ir::TypeTable{};
+    ASSERT_EQ(types.find(symbols::INT32), ir::types::INT32);
+    ASSERT_EQ(types.pointer_to(ir::types::UINT8), ir::types::UINT8_POINTER);
+    ASSERT_FALSE(types.find(intern("Point")).has_value());
+
+    const auto size = types.size();
+    const auto pointer = types.pointer_to(ir::types::UINT8_POINTER);
+    ASSERT_EQ(types.pointer_to(ir::types::UINT8_POINTER), pointer);
+    ASSERT_NE(pointer, ir::types::UINT8_POINTER);
+    ASSERT_EQ(types.size(), size + 1);
+    ASSERT_EQ(types.full_name(pointer), "Pointer<Pointer<UInt8>>");
+
+    const auto point = types.add_struct(std::make_unique<ir::StructType>(
+        intern("Point"),
+        std::unordered_map<Symbol, ir::TypeId>{{intern("x"), ir::types::INT32}},
+        std::unordered_map<Symbol, std::shared_ptr<ir::Function>>{}));
+    ASSERT_EQ(types.find(intern("Point")), point);
+    ASSERT_EQ(types.full_name(types.pointer_to(point)), "Pointer<Point>");
+
+    // Every use of a type in a program compiles to the same ID.
+    const std::string program = "extern fn f(a: Pointer<UInt8>, b: Int32)\n"
+                                "extern fn g(c: Pointer<UInt8>) -> Int32\n"
+                                "fn main() { f(\"s\", g(\"t\")) }\n";
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+    ASSERT_EQ(diagnostics.size(), 0);
+    ASSERT_EQ(module.types.size(), ir::TypeTable{}.size());
+    const auto& f = *module.functions.at(intern("f"));
+    ASSERT_EQ(f.parameters[0].type, ir::types::UINT8_POINTER);
+    ASSERT_EQ(f.parameters[1].type, ir::types::INT32);
+    ASSERT_EQ(f.return_type, ir::types::VOID);
+}
+
+TEST(IRTest, TestVisitDispatchesOnKind) {
+    const auto types = ir::TypeTable{};
+    const auto kind_name = Overloaded{
+        [](const ir::VoidType& /*type*/) { return "void"; },
+        [](const ir::PrimitiveType& /*type*/) { return "primitive"; },
+        [](const ir::PointerType& /*type*/) { return "pointer"; },
+        [](const ir::StructType& /*type*/) { return "struct"; },
+    };
+    ASSERT_STREQ(visit(types[ir::types::VOID], kind_name), "void");
+    ASSERT_STREQ(visit(types[ir::types::INT64], kind_name), "primitive");
+    ASSERT_STREQ(visit(types[ir::types::UINT8_POINTER], kind_name), "pointer");
+
+    const std::string program = "extern fn f(s: Pointer<UInt8>, i: Int32)\n"
+                                "fn main() { f(\"s\", 1) }\n";
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+    const auto& body = module.functions.at(symbols::MAIN)->body;
+    ASSERT_EQ(body.size(), 1);
+    const auto& call = *body[0];
+    ASSERT_EQ(call.kind, ir::IRNodeKind::function_call);
+    const auto arguments = visit(
+        call, Overloaded{
+                  [](const ir::FunctionCallIRNode& node) {
+                      return std::vector{node.arguments[0]->kind,
+                                         node.arguments[1]->kind};
+                  },
+                  [](const auto& /*node*/) {
+                      return std::vector<ir::IRNodeKind>{};
+                  },
+              });
+    ASSERT_EQ(arguments, (std::vector{ir::IRNodeKind::string_literal,
+                                      ir::IRNodeKind::integer_literal}));
+}
+
+TEST(IRTest, TestForwardReferences) {
+    const std::string program = "fn main() -> Int32 { g() return f(1) }\n"
+                                "extern fn g(p: Pointer<Point>)\n"
+                                "fn f(value: Int32) -> Int32 { return f(2) }\n"
+                                "struct Point {\n    x: Int32\n}\n";
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+    // g is declared, but called with the wrong number of arguments.
+    ASSERT_EQ(diagnostics.size(), 1);
+    ASSERT_EQ((*diagnostics.begin()).message,
+              "Function g expects 1 arguments, got 0");
+
+    const auto& g = *module.functions.at(intern("g"));
+    ASSERT_EQ(module.types.full_name(g.parameters[0].type), "Pointer<Point>");
+    const auto& f = module.functions.at(intern("f"));
+    const auto& main = *module.functions.at(symbols::MAIN);
+    ASSERT_EQ(main.return_value->kind, ir::IRNodeKind::function_call);
+    ASSERT_EQ(
+        static_cast<const ir::FunctionCallIRNode&>(*main.return_value).function,
+        f);
+    ASSERT_EQ(static_cast<const ir::FunctionCallIRNode&>(*f->return_value)
+                  .function,
+              f);
+}
+
+// A function that fails to compile is dropped, and so are calls to it, even
+// if they come before it.
+TEST(IRTest, TestCallsToInvalidFunctionsFail) {
+    const std::string program =
+        "extern fn printf(s: Pointer<UInt8>, ...) -> Int32\n"
+        "fn main() { printf(\"%d\", g()) printf(\"ok\") }\n"
+        "fn g() -> Int32 { return \"x\" }\n"
+        "fn h() -> Int32 { return g() }\n";
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+
+    auto messages = std::vector<std::string>{};
+    for (const auto& diagnostic : diagnostics) {
+        messages.push_back(diagnostic.message);
+    }
+    ASSERT_EQ(messages,
+              (std::vector<std::string>{
+                  "Unknown function: g",
+                  "Function printf argument 1 could not be compiled",
+                  "Function g expects a return value of type Int32, got "
+                  "Pointer<UInt8>",
+                  "Unknown function: g"}));
+
+    ASSERT_FALSE(module.functions.contains(intern("g")));
+    const auto& main = *module.functions.at(symbols::MAIN);
+    ASSERT_EQ(main.body.size(), 2);
+    ASSERT_EQ(main.body[0], nullptr);
+    ASSERT_EQ(
+        static_cast<const ir::FunctionCallIRNode&>(*main.body[1]).function,
+        module.functions.at(intern("printf")));
+    ASSERT_EQ(module.functions.at(intern("h"))->return_value, nullptr);
+}
+
+// An argument of the wrong type fails its call, and the calls around it.
+TEST(IRTest, TestArgumentTypeMismatchFailsCall) {
+    const std::string program =
+        "extern fn puts(s: Pointer<UInt8>) -> Int32\n"
+        "fn main() { puts(1) puts(puts(\"x\")) puts(\"ok\") }\n";
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+
+    auto messages = std::vector<std::string>{};
+    for (const auto& diagnostic : diagnostics) {
+        messages.push_back(diagnostic.message);
+    }
+    ASSERT_EQ(messages,
+              (std::vector<std::string>{
+                  "Function puts expects argument 0 to be of type "
+                  "Pointer<UInt8>, got Int32",
+                  "Function puts expects argument 0 to be of type "
+                  "Pointer<UInt8>, got Int32"}));
+
+    const auto& main = *module.functions.at(symbols::MAIN);
+    ASSERT_EQ(main.body.size(), 3);
+    ASSERT_EQ(main.body[0], nullptr);
+    ASSERT_EQ(main.body[1], nullptr);
+    ASSERT_NE(main.body[2], nullptr);
+}
+
+TEST(IRTest, TestParallelCompileMatchesSerial) {
+    auto program = std::string{"extern fn f(value: Int32) -> Int32\n"};
+    for (size_t i = 0; i < 64; ++i) {
+        const auto name = "g" + std::to_string(i);
+        // Every third function has errors, reported in source order.
+        const auto argument = i % 3 == 0 ? "\"s\"" : std::to_string(i);
+        program += "fn " + name + "() -> Int32 { return f(" + argument +
+                   ") }\n";
+        program += "fn main" + std::to_string(i) + "() { " + name + "() " +
+                   (i % 3 == 0 ? "h() " : "") + "}\n";
+    }
+
+    auto ast = Ast{};
+    auto parse_diagnostics = Diagnostics{};
+    const auto roots =
+        parse(lex(program, parse_diagnostics), ast, parse_diagnostics);
+    ASSERT_EQ(parse_diagnostics.size(), 0);
+
+    auto serial_diagnostics = Diagnostics{};
+    const auto serial = ir::compile(ast, ast[roots], serial_diagnostics);
+    auto pool = ThreadPool{4};
+    auto parallel_diagnostics = Diagnostics{};
+    const auto parallel =
+        ir::compile_parallel(ast, ast[roots], parallel_diagnostics, pool);
+
+    ASSERT_EQ(serial_diagnostics.size(), 22 * 2);
+    ASSERT_EQ(parallel_diagnostics.size(), serial_diagnostics.size());
+    for (auto serial_it = serial_diagnostics.begin(),
+              parallel_it = parallel_diagnostics.begin();
+         serial_it != serial_diagnostics.end(); ++serial_it, ++parallel_it) {
+        ASSERT_EQ(parallel_it->message, serial_it->message);
+        ASSERT_EQ(parallel_it->source, serial_it->source);
+    }
+    ASSERT_EQ(parallel.functions.size(), serial.functions.size());
+    for (const auto& [name, function] : serial.functions) {
+        const auto& other = *parallel.functions.at(name);
+        ASSERT_EQ(other.body.size(), function->body.size());
+        ASSERT_EQ(other.return_value == nullptr,
+                  function->return_value == nullptr);
+    }
+}
+
+namespace {
+
+// The IR views into `program`, which has to outlive it.
+auto compile_program(const std::string& program, Ast& ast) -> ir::Module {
+    auto diagnostics = Diagnostics{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    auto module = ir::compile(ast, ast[roots], diagnostics);
+    EXPECT_EQ(diagnostics.size(), 0);
+    return module;
+}
+
+auto callee(const std::shared_ptr<ir::IRNode>& node) -> Symbol {
+    EXPECT_EQ(node->kind, ir::IRNodeKind::function_call);
+    return static_cast<const ir::FunctionCallIRNode&>(*node).function->name;
+}
+
+} // namespace
+
+TEST(IRTest, TestFoldConstantCalls) {
+    auto ast = Ast{};
+    const std::string program =
+        "extern fn printf(s: Pointer<UInt8>, ...) -> Int32\n"
+        "fn meaning_of_life() -> Int32 { return 42 }\n"
+        "fn answer() -> Int32 { return meaning_of_life() }\n"
+        "fn id(value: Int32) -> Int32 { return 1 }\n"
+        "fn main() {\n"
+        "    printf(\"%d\", answer())\n"
+        "    id(printf(\"%d\", 1))\n"
+        "}\n";
+    auto module = compile_program(program, ast);
+    // answer() folds once meaning_of_life() within it has.
+    ASSERT_EQ(ir::fold_constant_calls(module), 2);
+
+    const auto& main = *module.functions.at(symbols::MAIN);
+    const auto& printf =
+        static_cast<const ir::FunctionCallIRNode&>(*main.body[0]);
+    ASSERT_EQ(printf.arguments[1]->kind, ir::IRNodeKind::integer_literal);
+    ASSERT_EQ(
+        static_cast<const ir::IntegerLiteralIRNode&>(*printf.arguments[1])
+            .value.value,
+        42);
+    // The call to printf in its arguments still has to happen.
+    ASSERT_EQ(callee(main.body[1]), intern("id"));
+    ASSERT_EQ(ir::fold_constant_calls(module), 0);
+}
+
+TEST(IRTest, TestInlineCalls) {
+    auto ast = Ast{};
+    const std::string program =
+        "extern fn puts(s: Pointer<UInt8>) -> Int32\n"
+        "fn greet(n: Int32) -> Int32 { puts(\"hi\") return puts(\"!\") }\n"
+        "fn twice() { greet(1) greet(2) }\n"
+        "fn main() -> Int32 { twice() greet(puts(\"a\")) return greet(3) }\n";
+    auto module = compile_program(program, ast);
+    // greet is a leaf and inlined everywhere. twice calls greet, so it only
+    // becomes a leaf after this pass.
+    ASSERT_EQ(ir::inline_calls(module), 4);
+
+    const auto& twice = *module.functions.at(intern("twice"));
+    ASSERT_EQ(twice.body.size(), 4);
+    for (const auto& statement : twice.body) {
+        ASSERT_EQ(callee(statement), intern("puts"));
+    }
+
+    const auto& main = *module.functions.at(symbols::MAIN);
+    ASSERT_EQ(main.body.size(), 5);
+    ASSERT_EQ(callee(main.body[0]), intern("twice"));
+    // The argument's call comes before greet's body.
+    ASSERT_EQ(static_cast<const ir::StringLiteralIRNode&>(
+                  *static_cast<const ir::FunctionCallIRNode&>(*main.body[1])
+                       .arguments[0])
+                  .value.value,
+              "a");
+    ASSERT_EQ(callee(main.return_value), intern("puts"));
+}
+
+TEST(IRTest, TestRemoveDeadFunctions) {
+    auto ast = Ast{};
+    const std::string program =
+        "extern fn puts(s: Pointer<UInt8>) -> Int32\n"
+        "extern fn unused(s: Pointer<UInt8>) -> Int32\n"
+        "fn ping() { pong() }\n"
+        "fn pong() { ping() }\n"
+        "fn helper() -> Int32 { return puts(\"used\") }\n"
+        "fn main() { helper() }\n";
+    auto module = compile_program(program, ast);
+    ASSERT_EQ(ir::remove_dead_functions(module), 3);
+    ASSERT_EQ(module.functions.size(), 3);
+    ASSERT_TRUE(module.functions.contains(intern("puts")));
+    ASSERT_TRUE(module.functions.contains(intern("helper")));
+    ASSERT_TRUE(module.functions.contains(symbols::MAIN));
+
+    // Without main, there's no telling what's used.
+    const std::string library_program = "fn f() {}\n";
+    auto library = compile_program(library_program, ast);
+    ASSERT_EQ(ir::remove_dead_functions(library), 0);
+    ASSERT_EQ(library.functions.size(), 1);
+}
+
+TEST(IRTest, TestPassManager) {
+    auto ast = Ast{};
+    const std::string program =
+        "extern fn printf(s: Pointer<UInt8>, ...) -> Int32\n"
+        "fn meaning_of_life() -> Int32 { return 42 }\n"
+        "fn main() { printf(\"%d\", meaning_of_life()) }\n";
+
+    auto passes = ir::PassManager{};
+    auto module = compile_program(program, ast);
+    const auto statistics = passes.run(module);
+    ASSERT_EQ(statistics.size(), 3);
+    ASSERT_EQ(statistics[0].pass, ir::Pass::fold_constant_calls);
+    ASSERT_EQ(statistics[0].changes, 1);
+    ASSERT_EQ(statistics[1].pass, ir::Pass::inline_calls);
+    ASSERT_EQ(statistics[1].changes, 0);
+    ASSERT_EQ(statistics[2].pass, ir::Pass::remove_dead_functions);
+    ASSERT_EQ(statistics[2].changes, 1);
+    ASSERT_FALSE(module.functions.contains(intern("meaning_of_life")));
+
+    ASSERT_TRUE(passes.configure("remove_dead_functions"));
+    ASSERT_FALSE(passes.is_enabled(ir::Pass::fold_constant_calls));
+    module = compile_program(program, ast);
+    const auto dead_only = passes.run(module);
+    ASSERT_EQ(dead_only.size(), 1);
+    ASSERT_EQ(dead_only[0].changes, 0);
+    ASSERT_TRUE(module.functions.contains(intern("meaning_of_life")));
+
+    ASSERT_FALSE(passes.configure("inline_calls,unrolling"));
+    ASSERT_TRUE(passes.is_enabled(ir::Pass::inline_calls));
+    ASSERT_TRUE(passes.configure(""));
+    ASSERT_TRUE(passes.run(module).empty());
+}
@@ -0,0 +1,262 @@
+#include "core/ir/passes.h"
+#include "core/ir/ir.h"
+#include "core/util/trace.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using namespace xlang;
+using namespace xlang::ir;
+
+namespace {
+
+auto is_call(const std::shared_ptr<IRNode>& node) -> bool {
+    return node && node->kind == IRNodeKind::function_call;
+}
+
+auto as_call(const std::shared_ptr<IRNode>& node) -> FunctionCallIRNode& {
+    return static_cast<FunctionCallIRNode&>(*node);
+}
+
+// Calls `visitor` with every node slot of `function`, arguments before the
+// calls they belong to, so the visitor may replace the node in its slot.
+// Calls nest as deep as the parser allows, so this doesn't recurse.
+template <typename Visitor>
+auto for_each_slot(Function& function, Visitor&& visitor) -> void {
+    struct Entry {
+        std::shared_ptr<IRNode>* slot;
+        bool expanded;
+    };
+    auto stack = std::vector<Entry>{};
+    const auto walk = [&](std::shared_ptr<IRNode>& root) {
+        stack.push_back({&root, false});
+        while (!stack.empty()) {
+            auto& entry = stack.back();
+            if (entry.expanded || !is_call(*entry.slot)) {
+                auto* const slot = entry.slot;
+                stack.pop_back();
+                visitor(*slot);
+                continue;
+            }
+            entry.expanded = true;
+            auto& arguments = as_call(*entry.slot).arguments;
+            for (auto it = arguments.rbegin(); it != arguments.rend(); ++it) {
+                stack.push_back({&*it, false});
+            }
+        }
+    };
+
+    for (auto& statement : function.body) {
+        walk(statement);
+    }
+    if (function.return_value) {
+        walk(function.return_value);
+    }
+}
+
+// Whether every call made by `function`'s statements and return value goes
+// to an extern.
+auto calls_only_externs(Function& function) -> bool {
+    bool leaf = true;
+    for_each_slot(function, [&](std::shared_ptr<IRNode>& node) {
+        if (is_call(node) && !as_call(node).function->external) {
+            leaf = false;
+        }
+    });
+    return leaf;
+}
+
+// A function whose call can be replaced by its return value, which is a
+// literal.
+auto is_constant(const Function& function) -> bool {
+    return !function.external && function.return_value &&
+           !is_call(function.return_value) &&
+           std::none_of(function.body.begin(), function.body.end(), is_call);
+}
+
+} // namespace
+
+auto xlang::ir::fold_constant_calls(Module& module) -> size_t {
+    size_t folded = 0;
+    // Folding a function's return value can make the function constant in
+    // turn, so this repeats until nothing changes.
+    size_t round = 0;
+    do {
+        round = 0;
+        for (auto& [name, function] : module.functions) {
+            for_each_slot(*function, [&](std::shared_ptr<IRNode>& node) {
+                if (!is_call(node)) {
+                    return;
+                }
+                const auto& call = as_call(node);
+                if (!is_constant(*call.function) ||
+                    std::any_of(call.arguments.begin(), call.arguments.end(),
+                                is_call)) {
+                    return;
+                }
+                XLANG_TRACE(ir, debug,
+                            "Folding call to " << call.function->name
+                                               << " in " << name);
+                // Literals aren't changed once built, so they can be shared.
+                node = call.function->return_value;
+                ++round;
+            });
+        }
+        folded += round;
+    } while (round > 0);
+    return folded;
+}
+
+auto xlang::ir::inline_calls(Module& module) -> size_t {
+    // Decided up front, so what gets inlined doesn't depend on the order the
+    // functions are visited in.
+    auto leaves = std::unordered_set<const Function*>{};
+    for (auto& [name, function] : module.functions) {
+        const auto statements =
+            function->body.size() + (function->return_value ? 1 : 0);
+        if (!function->external && !function->variadic &&
+            statements <= INLINE_STATEMENT_LIMIT &&
+            calls_only_externs(*function)) {
+            leaves.insert(function.get());
+        }
+    }
+
+    size_t inlined = 0;
+    for (auto& [name, function] : module.functions) {
+        if (function->external) {
+            continue;
+        }
+        const auto inlinable = [&](const std::shared_ptr<IRNode>& node) {
+            return is_call(node) &&
+                   leaves.contains(as_call(node).function.get());
+        };
+
+        // Arguments are evaluated before the callee's body, and only the ones
+        // that make calls have any effect. Returns the callee's return value.
+        auto body = std::vector<std::shared_ptr<IRNode>>{};
+        const auto inline_call = [&](const std::shared_ptr<IRNode>& node) {
+            const auto& call = as_call(node);
+            XLANG_TRACE(ir, debug,
+                        "Inlining " << call.function->name << " into "
+                                    << name);
+            std::copy_if(call.arguments.begin(), call.arguments.end(),
+                         std::back_inserter(body), is_call);
+            body.insert(body.end(), call.function->body.begin(),
+                        call.function->body.end());
+            ++inlined;
+            return call.function->return_value;
+        };
+
+        body.reserve(function->body.size());
+        for (auto& statement : function->body) {
+            if (!inlinable(statement)) {
+                body.push_back(std::move(statement));
+                continue;
+            }
+            // The value of a statement is unused, so only a call is kept.
+            if (auto value = inline_call(statement); is_call(value)) {
+                body.push_back(std::move(value));
+            }
+        }
+        if (inlinable(function->return_value)) {
+            function->return_value = inline_call(function->return_value);
+        }
+        function->body = std::move(body);
+    }
+    return inlined;
+}
+
+auto xlang::ir::remove_dead_functions(Module& module) -> size_t {
+    const auto main = module.functions.find(symbols::MAIN);
+    if (main == module.functions.end()) {
+        return 0;
+    }
+
+    auto reachable = std::unordered_set<const Function*>{main->second.get()};
+    auto pending = std::vector<Function*>{main->second.get()};
+    while (!pending.empty()) {
+        auto* const function = pending.back();
+        pending.pop_back();
+        for_each_slot(*function, [&](std::shared_ptr<IRNode>& node) {
+            if (is_call(node)) {
+                auto* const callee = as_call(node).function.get();
+                if (reachable.insert(callee).second) {
+                    pending.push_back(callee);
+                }
+            }
+        });
+    }
+
+    return std::erase_if(module.functions, [&](auto& entry) {
+        auto& [name, function] = entry;
+        if (reachable.contains(function.get())) {
+            return false;
+        }
+        XLANG_TRACE(ir, debug, "Removing unreachable function " << name);
+        // Dead functions can still call each other, which Module's
+        // destructor would no longer untangle.
+        function->body.clear();
+        function->return_value = nullptr;
+        return true;
+    });
+}
+
+auto PassManager::configure(std::string_view passes) -> bool {
+    enabled.fill(false);
+    bool valid = true;
+    while (!passes.empty()) {
+        const auto comma = passes.find(',');
+        const auto name = passes.substr(0, comma);
+        passes = comma == std::string_view::npos ? std::string_view{}
+                                                 : passes.substr(comma + 1);
+
+        bool found = false;
+        for (size_t i = 0; i < static_cast<size_t>(Pass::count); ++i) {
+            if (Pass_to_string(static_cast<Pass>(i)) == name) {
+                enabled[i] = true;
+                found = true;
+            }
+        }
+        valid = valid && found;
+    }
+    return valid;
+}
+
+auto PassManager::run(Module& module) const -> std::vector<PassStatistics> {
+    auto statistics = std::vector<PassStatistics>{};
+    for (size_t i = 0; i < static_cast<size_t>(Pass::count); ++i) {
+        if (!enabled[i]) {
+            continue;
+        }
+        const auto pass = static_cast<Pass>(i);
+        const auto start = std::chrono::steady_clock::now();
+        size_t changes = 0;
+        switch (pass) {
+        case Pass::fold_constant_calls:
+            changes = fold_constant_calls(module);
+            break;
+        case Pass::inline_calls:
+            changes = inline_calls(module);
+            break;
+        case Pass::remove_dead_functions:
+            changes = remove_dead_functions(module);
+            break;
+        case Pass::count:
+            break;
+        }
+        const auto duration = std::chrono::steady_clock::now() - start;
+        XLANG_TRACE(ir, info,
+                    pass << ": " << changes << " changes in "
+                         << std::chrono::duration_cast<
+                                std::chrono::microseconds>(duration)
+                                .count()
+                         << " us");
+        statistics.push_back({pass, changes, duration});
+    }
+    return statistics;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "core/ir/ir.h"
+#include "core/util/enum.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace xlang::ir {
+
+// Rewrites of a Module that keep what the program does. PassManager runs them
+// in this order.
+ENUM_CLASS(Pass, fold_constant_calls, inline_calls, remove_dead_functions);
+
+// Functions with at most this many statements, return value included, are
+// inlined by inline_calls().
+constexpr size_t INLINE_STATEMENT_LIMIT = 8;
+
+// Replaces calls to functions that only return a literal with the literal.
+// Calls with calls among their arguments are kept, since those arguments
+// have effects. Returns the number of calls folded.
+auto fold_constant_calls(Module& module) -> size_t;
+
+// Replaces calls to small leaf functions, which call nothing but externs,
+// with their bodies. Only calls that are statements or return values are
+// inlined, since a body can't go in the middle of an expression. Returns the
+// number of calls inlined.
+auto inline_calls(Module& module) -> size_t;
+
+// Drops every function that main can't reach. A module without main is left
+// as it is. Returns the number of functions dropped.
+auto remove_dead_functions(Module& module) -> size_t;
+
+// What one run of a pass did.
+struct PassStatistics {
+    Pass pass;
+    // Calls folded or inlined, or functions dropped.
+    size_t changes = 0;
+    std::chrono::nanoseconds duration{};
+};
+
+// Runs the enabled passes over a module. Every pass is enabled to begin with.
+class PassManager {
+  public:
+    PassManager() { enabled.fill(true); }
+
+    auto set_enabled(Pass pass, bool value) -> void {
+        enabled[static_cast<size_t>(pass)] = value;
+    }
+
+    [[nodiscard]] auto is_enabled(Pass pass) const -> bool {
+        return enabled[static_cast<size_t>(pass)];
+    }
+
+    // Enables exactly the passes named in the comma-separated `passes`, such
+    // as "fold_constant_calls,remove_dead_functions". An empty list disables
+    // every pass. Returns false, after enabling the valid names, if any name
+    // is unknown.
+    auto configure(std::string_view passes) -> bool;
+
+    // Runs each enabled pass once, in the order of Pass, and returns what
+    // each did.
+    auto run(Module& module) const -> std::vector<PassStatistics>;
+
+  private:
+    std::array<bool, static_cast<size_t>(Pass::count)> enabled{};
+};
+
+} // namespace xlang::ir
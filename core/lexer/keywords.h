@@ -0,0 +1,102 @@
+#pragma once
+
+#include "token.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace xlang {
+
+struct Keyword {
+    std::string_view spelling;
+    TokenType type;
+};
+
+// Every reserved word. Adding a keyword only takes a new entry here.
+constexpr auto KEYWORDS = std::array{
+    Keyword{"fn", TokenType::function},
+    Keyword{"extern", TokenType::external},
+    Keyword{"var", TokenType::variable},
+    Keyword{"struct", TokenType::structure},
+    Keyword{"return", TokenType::_return},
+};
+
+// Perfect hash table over KEYWORDS, built at compile time. A lookup rejects by
+// length, hashes the length and the first and last bytes, and does at most one
+// string comparison.
+class KeywordTable {
+  public:
+    static constexpr size_t BITS = std::bit_width(KEYWORDS.size() * 2 - 1);
+    static constexpr size_t SIZE = size_t{1} << BITS;
+
+    constexpr KeywordTable() {
+        for (const auto& keyword : KEYWORDS) {
+            min_length = std::min(min_length, keyword.spelling.size());
+            max_length = std::max(max_length, keyword.spelling.size());
+        }
+
+        // Multipliers stay odd so every one is a bijection on uint32_t.
+        constexpr uint32_t golden_ratio = 0x9E3779B1U;
+        for (uint32_t attempt = 0; attempt < 1U << 16U; ++attempt) {
+            seed = golden_ratio + 2 * attempt;
+            if (try_fill()) {
+                return;
+            }
+        }
+        seed = 0;
+    }
+
+    [[nodiscard]] constexpr auto valid() const -> bool { return seed != 0; }
+
+    [[nodiscard]] constexpr auto find(std::string_view word) const
+        -> std::optional<TokenType> {
+        if (word.size() < min_length || word.size() > max_length) {
+            return std::nullopt;
+        }
+        const auto& slot = slots[hash(word, seed)];
+        if (!slot.has_value() || slot->spelling != word) {
+            return std::nullopt;
+        }
+        return slot->type;
+    }
+
+  private:
+    static constexpr auto hash(std::string_view word, uint32_t seed)
+        -> size_t {
+        auto key = static_cast<uint32_t>(word.size());
+        key = key * 31 + static_cast<unsigned char>(word.front());
+        key = key * 31 + static_cast<unsigned char>(word.back());
+        return (key * seed) >> (32 - BITS);
+    }
+
+    constexpr auto try_fill() -> bool {
+        slots = {};
+        for (const auto& keyword : KEYWORDS) {
+            auto& slot = slots[hash(keyword.spelling, seed)];
+            if (slot.has_value()) {
+                return false;
+            }
+            slot = keyword;
+        }
+        return true;
+    }
+
+    uint32_t seed = 0;
+    size_t min_length = SIZE_MAX;
+    size_t max_length = 0;
+    std::array<std::optional<Keyword>, SIZE> slots{};
+};
+
+constexpr auto KEYWORD_TABLE = KeywordTable{};
+
+static_assert(KEYWORD_TABLE.valid(), "No perfect hash found for KEYWORDS");
+
+// The keyword token type for `word`, or std::nullopt for plain identifiers.
+constexpr auto keyword_type(std::string_view word) -> std::optional<TokenType> {
+    return KEYWORD_TABLE.find(word);
+}
+
+} // namespace xlang
@@ -1,182 +1,231 @@
 #include "lexer.h"
+#include "keywords.h"
+#include "core/util/trace.h"
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <vector>
 
 using namespace xlang;
 
-ENUM_CLASS(LexerState, none, identifier, string_literal, integer_literal);
+Lexer::Lexer(std::string_view input, Diagnostics& diagnostics, ScanIsa isa,
+             LineIndex* lines)
+    : input{input}, diagnostics{&diagnostics}, scan{&scan_kernels(isa)},
+      lines{lines} {}
 
-// NOLINTNEXTLINE(readability-function-cognitive-complexity)
-auto xlang::lex(Buffer<std::string> input, Diagnostics& diagnostics)
-    -> std::vector<Token> {
-    std::vector<Token> tokens{};
-
-    std::string identifier{};
+auto Lexer::new_line(size_t start) -> void {
+    line += 1;
+    line_start = start;
+    if (lines != nullptr) {
+        lines->add_line(static_cast<uint32_t>(start));
+    }
+}
 
-    auto source = Source{
-        .line = 0,
-        .column = 0,
+// Returns the lexeme for the `length` bytes at the current position and moves
+// past them.
+auto Lexer::emit(TokenType type, size_t length, Symbol symbol) -> Lexeme {
+    const auto lexeme = Lexeme{
+        .type = type,
+        .offset = static_cast<uint32_t>(position),
+        .length = static_cast<uint32_t>(length),
+        .symbol = symbol,
+        .source = source(),
     };
+    position += length;
+    return lexeme;
+}
 
-    LexerState state = LexerState::none;
-
-    // TODO: refactor with safe peek / pop
+// NOLINTNEXTLINE(readability-function-cognitive-complexity)
+auto Lexer::next() -> std::optional<Lexeme> {
+    const auto peek = [&](size_t skip) -> char {
+        return position + skip < input.size() ? input[position + skip] : '\0';
+    };
 
-    while (!input.empty()) {
-        switch (state) {
-        case LexerState::none:
-            switch (input.peek()) {
-            case '(':
-                input.pop();
-                tokens.emplace_back(TokenType::paren_open, source);
-                source.column += 1;
-                break;
-            case ')':
-                input.pop();
-                tokens.emplace_back(TokenType::paren_close, source);
-                source.column += 1;
-                break;
-            case '{':
-                input.pop();
-                tokens.emplace_back(TokenType::curly_open, source);
-                source.column += 1;
-                break;
-            case '}':
-                input.pop();
-                tokens.emplace_back(TokenType::curly_close, source);
-                source.column += 1;
-                break;
-            case '=':
-                input.pop();
-                tokens.emplace_back(TokenType::equal, source);
-                source.column += 1;
-                break;
-            case ':':
-                input.pop();
-                tokens.emplace_back(TokenType::colon, source);
-                source.column += 1;
-                break;
-            case ',':
-                input.pop();
-                tokens.emplace_back(TokenType::comma, source);
-                source.column += 1;
-                break;
-            case '.': {
-                input.pop();
-                if (input.safe_peek() == '.' && input.safe_peek(1) == '.') {
-                    input.pop();
-                    input.pop();
-                    tokens.emplace_back(TokenType::variadic, source);
-                    source.column += 3;
-                } else {
-                    tokens.emplace_back(TokenType::dot, source);
-                    source.column += 1;
-                }
-            } break;
-            case '<':
-                input.pop();
-                tokens.emplace_back(TokenType::angle_open, source);
-                source.column += 1;
-                break;
-            case '>':
-                input.pop();
-                tokens.emplace_back(TokenType::angle_close, source);
-                source.column += 1;
-                break;
-            case '"':
-                state = LexerState::string_literal;
-                input.pop();
-                break;
-            case '-':
-                if (input.safe_peek(1) == '>') {
-                    input.pop();
-                    input.pop();
-                    tokens.emplace_back(TokenType::arrow, source);
-                    source.column += 2;
-                } else {
-                    input.pop();
-                    diagnostics.push_error("Expected arrow", source);
-                }
-                break;
-            case ' ':
-                input.pop();
-                source.column += 1;
-                break;
-            case '\n':
-                input.pop();
-                // tokens.emplace_back(TokenType::new_line, source);
-                source.line += 1;
-                source.column = 0;
-                break;
-            case '\t':
-                diagnostics.push_error("Tabs are not allowed", source);
+    while (position < input.size()) {
+        const char current = input[position];
+        switch (current) {
+        case '(':
+            return emit(TokenType::paren_open, 1);
+        case ')':
+            return emit(TokenType::paren_close, 1);
+        case '{':
+            return emit(TokenType::curly_open, 1);
+        case '}':
+            return emit(TokenType::curly_close, 1);
+        case '=':
+            return emit(TokenType::equal, 1);
+        case ':':
+            return emit(TokenType::colon, 1);
+        case ',':
+            return emit(TokenType::comma, 1);
+        case '.':
+            if (peek(1) == '.' && peek(2) == '.') {
+                return emit(TokenType::variadic, 3);
+            }
+            return emit(TokenType::dot, 1);
+        case '<':
+            return emit(TokenType::angle_open, 1);
+        case '>':
+            return emit(TokenType::angle_close, 1);
+        case '"': {
+            const auto start = position + 1;
+            const auto end = scan->find_quote(input, start);
+            if (end == input.size()) {
+                diagnostics->push_error("Unterminated string literal",
+                                        source());
+                position = end;
                 break;
-            default: {
-                if (std::isalpha(input.peek()) != 0) {
-                    state = LexerState::identifier;
-                } else if (std::isdigit(input.peek()) != 0) {
-                    state = LexerState::integer_literal;
-                } else {
-                    const auto unknown = input.pop();
-                    tokens.emplace_back(TokenType::unknown,
-                                        std::string(1, unknown), source);
-                    state = LexerState::none;
-                    diagnostics.push_error("Unknown token: '" +
-                                               std::string(1, unknown) + "'",
-                                           source);
-                    source.column += 1;
+            }
+            const auto lexeme =
+                emit(TokenType::string_literal, end + 1 - position);
+            // Literals may span lines.
+            for (auto i = start; i < end; ++i) {
+                if (input[i] == '\n') {
+                    new_line(i + 1);
                 }
-            } break;
             }
+            return lexeme;
+        }
+        case '-':
+            if (peek(1) == '>') {
+                return emit(TokenType::arrow, 2);
+            }
+            diagnostics->push_error("Expected arrow", source());
+            position += 1;
+            break;
+        case ' ':
+            position = scan->skip_spaces(input, position);
+            break;
+        case '\n':
+            position += 1;
+            new_line(position);
             break;
-        case LexerState::identifier:
-            if (std::isalnum(input.peek()) != 0 || input.peek() == '_') {
-                identifier.push_back(input.pop());
-            } else {
-                if (identifier == "fn") {
-                    tokens.emplace_back(TokenType::function, source);
-                } else if (identifier == "extern") {
-                    tokens.emplace_back(TokenType::external, source);
-                } else if (identifier == "var") {
-                    tokens.emplace_back(TokenType::variable, source);
-                } else if (identifier == "struct") {
-                    tokens.emplace_back(TokenType::structure, source);
-                } else if (identifier == "return") {
-                    tokens.emplace_back(TokenType::_return, source);
-                } else {
-                    tokens.emplace_back(TokenType::identifier, identifier,
-                                        source);
+        case '\t':
+            diagnostics->push_error("Tabs are not allowed", source());
+            position += 1;
+            break;
+        default: {
+            if (is_alpha(current)) {
+                const auto end = scan->identifier_end(input, position + 1);
+                const auto identifier = input.substr(position, end - position);
+                if (const auto keyword = keyword_type(identifier)) {
+                    return emit(keyword.value(), identifier.size());
                 }
-                source.column += (int)identifier.size();
-                identifier.clear();
-                state = LexerState::none;
+                return emit(TokenType::identifier, identifier.size(),
+                            intern(identifier));
             }
-            break;
-        case LexerState::string_literal:
-            if (input.peek() == '"') {
-                input.pop();
-                state = LexerState::none;
-                tokens.emplace_back(TokenType::string_literal, identifier,
-                                    source);
-                source.column += (int)identifier.size() + 2;
-                identifier.clear();
-            } else {
-                identifier.push_back(input.pop());
+            if (is_digit(current)) {
+                const auto end = scan->digits_end(input, position + 1);
+                return emit(TokenType::integer_literal, end - position);
             }
-            break;
-        case LexerState::integer_literal: {
-            if (std::isdigit(input.peek()) != 0) {
-                identifier.push_back(input.pop());
-            } else {
-                state = LexerState::none;
-                tokens.emplace_back(TokenType::integer_literal, identifier,
-                                    source);
-                source.column += (int)identifier.size();
-                identifier.clear();
+            diagnostics->push_error(
+                "Unknown token: '" + std::string(1, current) + "'", source());
+            return emit(TokenType::unknown, 1);
+        }
+        }
+    }
+
+    return std::nullopt;
+}
+
+auto xlang::lex(std::string_view input, Diagnostics& diagnostics, ScanIsa isa)
+    -> TokenStream {
+    TokenStream tokens{input};
+    LineIndex lines;
+
+    auto lexer = Lexer{input, diagnostics, isa, &lines};
+    while (const auto lexeme = lexer.next()) {
+        tokens.push(lexeme->type, lexeme->offset, lexeme->length,
+                    lexeme->symbol);
+    }
+
+    tokens.set_line_index(std::move(lines));
+    return tokens;
+}
+
+namespace {
+
+// Offsets that split `input` into chunks which lex the same on their own as
+// in place: starts of lines outside string literals, about `chunk_size` bytes
+// apart. The first is 0 and the last is the size of `input`.
+auto chunk_boundaries(std::string_view input, size_t chunk_size,
+                      ThreadPool& pool) -> std::vector<size_t> {
+    const auto count = (input.size() + chunk_size - 1) / chunk_size;
+
+    // Literals have no escapes, so a position is inside one exactly when an
+    // odd number of quotes precede it. Counting quotes is the only pass over
+    // the whole input, and it runs in parallel.
+    auto quotes = std::vector<size_t>(count);
+    pool.for_each(count, [&](size_t i) {
+        const auto chunk = input.substr(i * chunk_size, chunk_size);
+        quotes[i] = std::count(chunk.begin(), chunk.end(), '"');
+    });
+
+    auto boundaries = std::vector<size_t>{0};
+    size_t quotes_before = 0;
+    for (size_t i = 1; i < count; ++i) {
+        quotes_before += quotes[i - 1];
+        auto position = i * chunk_size;
+        if (position < boundaries.back()) {
+            continue;
+        }
+
+        // Split after the next newline that isn't part of a literal.
+        auto in_string = quotes_before % 2 == 1;
+        for (; position < input.size(); ++position) {
+            if (input[position] == '"') {
+                in_string = !in_string;
+            } else if (input[position] == '\n' && !in_string) {
+                break;
             }
-        } break;
-        default:
-            std::cerr << "Unknown lexer state: " << state << '\n';
+        }
+        if (position + 1 >= input.size()) {
             break;
-        };
+        }
+        boundaries.push_back(position + 1);
+    }
+    boundaries.push_back(input.size());
+    return boundaries;
+}
+
+} // namespace
+
+auto xlang::lex_parallel(std::string_view input, Diagnostics& diagnostics,
+                         ThreadPool& pool, size_t chunk_size, ScanIsa isa)
+    -> TokenStream {
+    const auto boundaries = chunk_boundaries(input, chunk_size, pool);
+    const auto count = boundaries.size() - 1;
+    if (count <= 1) {
+        return lex(input, diagnostics, isa);
+    }
+    XLANG_TRACE(lexer, info,
+                "Lexing " << input.size() << " bytes in " << count
+                          << " chunks on " << pool.size() << " threads");
+
+    auto chunks = std::vector<std::optional<TokenStream>>(count);
+    auto chunk_diagnostics = std::vector<Diagnostics>(count);
+    pool.for_each(count, [&](size_t i) {
+        const auto chunk =
+            input.substr(boundaries[i], boundaries[i + 1] - boundaries[i]);
+        chunks[i] = lex(chunk, chunk_diagnostics[i], isa);
+    });
+
+    // Every chunk starts a line, so rebasing only shifts offsets and lines.
+    TokenStream tokens{input};
+    size_t total = 0;
+    for (const auto& chunk : chunks) {
+        total += chunk->size();
+    }
+    tokens.reserve(total);
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto lines_before =
+            static_cast<int>(tokens.line_index().size() - 1);
+        for (auto diagnostic : chunk_diagnostics[i]) {
+            diagnostic.source.line += lines_before;
+            diagnostics.push(std::move(diagnostic));
+        }
+        tokens.append(chunks[i].value(), static_cast<uint32_t>(boundaries[i]));
     }
 
     return tokens;
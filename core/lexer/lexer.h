@@ -1,20 +1,150 @@
 #pragma once
 
-#include "core/util/buffer.h"
 #include "core/util/diagnostics.h"
+#include "core/util/thread_pool.h"
+#include "scan.h"
 #include "token.h"
+#include "token_stream.h"
+#include <array>
+#include <cassert>
+#include <concepts>
+#include <cstdint>
+#include <optional>
 #include <string>
-#include <utility>
-#include <vector>
+#include <string_view>
 
 namespace xlang {
 
-auto lex(Buffer<std::string> input, Diagnostics& diagnostics)
-    -> std::vector<Token>;
+// A token's kind and extent, before it's materialized as a Token.
+struct Lexeme {
+    TokenType type = TokenType::unknown;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    Symbol symbol;
+    Source source = {};
+};
 
-inline auto lex(std::string input, Diagnostics& diagnostics)
-    -> std::vector<Token> {
-    return lex(Buffer<std::string>(std::move(input)), diagnostics);
-}
+// Produces the tokens of `input` one at a time, on demand. The lexer views
+// into `input`, which must outlive it and every token it returns.
+class Lexer {
+  public:
+    // When `lines` is given, the start of every line is recorded into it.
+    Lexer(std::string_view input, Diagnostics& diagnostics,
+          ScanIsa isa = best_scan_isa(), LineIndex* lines = nullptr);
+
+    // The next lexeme, or std::nullopt at the end of the input.
+    auto next() -> std::optional<Lexeme>;
+
+    [[nodiscard]] auto token(const Lexeme& lexeme) const -> Token {
+        auto token = Token{lexeme.type, lexeme.source};
+        token.symbol = lexeme.symbol;
+        token.value = token_value(
+            lexeme.type, input.substr(lexeme.offset, lexeme.length));
+        return token;
+    }
+
+  private:
+    [[nodiscard]] auto source() const -> Source {
+        return Source{line, static_cast<int>(position - line_start)};
+    }
+
+    auto new_line(size_t start) -> void;
+
+    auto emit(TokenType type, size_t length, Symbol symbol = {}) -> Lexeme;
+
+    std::string_view input;
+    Diagnostics* diagnostics;
+    const ScanKernels* scan;
+    LineIndex* lines;
+    size_t position = 0;
+    int line = 0;
+    size_t line_start = 0;
+};
+
+// Reads tokens straight from a Lexer with Buffer's interface. Only a small
+// window of lookahead is ever held, so memory doesn't grow with the number of
+// tokens.
+class LexerCursor {
+  public:
+    static constexpr size_t LOOKAHEAD = 4;
+
+    explicit LexerCursor(Lexer& lexer) : lexer{&lexer} {}
+
+    [[nodiscard]] auto empty() const -> bool { return !fill(0); }
+
+    [[nodiscard]] auto peek_type(int skip = 0) const
+        -> std::optional<TokenType> {
+        if (!fill(skip)) {
+            return std::nullopt;
+        }
+        return at(skip).type;
+    }
+
+    [[nodiscard]] auto safe_peek(int skip = 0) const -> std::optional<Token> {
+        if (!fill(skip)) {
+            return std::nullopt;
+        }
+        return lexer->token(at(skip));
+    }
+
+    auto safe_pop() -> std::optional<Token> {
+        if (!fill(0)) {
+            return std::nullopt;
+        }
+        const auto token = lexer->token(at(0));
+        head = (head + 1) % LOOKAHEAD;
+        --count;
+        return token;
+    }
+
+    [[nodiscard]] auto peek() const -> Token { return safe_peek().value(); }
+
+    auto pop() -> Token { return safe_pop().value(); }
+
+  private:
+    // Lexes ahead until `skip` tokens past the current one are buffered.
+    // Returns false if the input ends first.
+    auto fill(size_t skip) const -> bool {
+        assert(skip < LOOKAHEAD);
+        while (count <= skip) {
+            const auto lexeme = lexer->next();
+            if (!lexeme.has_value()) {
+                return false;
+            }
+            window[(head + count) % LOOKAHEAD] = lexeme.value();
+            ++count;
+        }
+        return true;
+    }
+
+    [[nodiscard]] auto at(size_t skip) const -> const Lexeme& {
+        return window[(head + skip) % LOOKAHEAD];
+    }
+
+    Lexer* lexer;
+    mutable std::array<Lexeme, LOOKAHEAD> window{};
+    mutable size_t head = 0;
+    mutable size_t count = 0;
+};
+
+// Lexes all of `input` up front. The returned stream views into `input`,
+// which must outlive it. `isa` picks the scanning kernels and never changes
+// the result.
+auto lex(std::string_view input, Diagnostics& diagnostics,
+         ScanIsa isa = best_scan_isa()) -> TokenStream;
+
+constexpr size_t PARALLEL_LEX_CHUNK_SIZE = size_t{1} << 20U;
+
+// Lexes `input` on `pool`, in chunks of roughly `chunk_size` bytes split at
+// line starts outside string literals. The tokens and diagnostics are the same
+// as lex()'s, in the same order.
+auto lex_parallel(std::string_view input, Diagnostics& diagnostics,
+                  ThreadPool& pool, size_t chunk_size = PARALLEL_LEX_CHUNK_SIZE,
+                  ScanIsa isa = best_scan_isa()) -> TokenStream;
+
+// Lexing a temporary string would leave every token dangling.
+template <typename T>
+    requires std::same_as<T, std::string>
+auto lex(T&& input, Diagnostics& diagnostics) -> TokenStream = delete;
 
 } // namespace xlang
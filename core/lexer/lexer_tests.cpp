@@ -1,5 +1,8 @@
+#include "keywords.h"
 #include "lexer.h"
 #include <gtest/gtest.h>
+#include <random>
+#include <string>
 
 using namespace xlang;
 
@@ -28,6 +31,192 @@ TEST(LexerTest, TestTokenization) {
         Token{TokenType::curly_close, Source{3, 0}},
     };
 
-    ASSERT_EQ(parsed, expected);
+    ASSERT_EQ(parsed.tokens(), expected);
     ASSERT_EQ(diagnostics.size(), 0);
 }
+
+TEST(LexerTest, TestLazySources) {
+    auto diagnostics = Diagnostics{};
+    const std::string source = "var a = \"x\ny\"\n\n  b\n-c";
+    const auto tokens = lex(source, diagnostics);
+
+    ASSERT_EQ(tokens.size(), 6);
+    ASSERT_EQ(tokens.source(0), (Source{0, 0}));
+    ASSERT_EQ(tokens.source(3), (Source{0, 8}));
+    ASSERT_EQ(tokens.value(3), "x\ny");
+    ASSERT_EQ(tokens.source(4), (Source{3, 2}));
+    ASSERT_EQ(tokens.source(5), (Source{4, 1}));
+    ASSERT_EQ(tokens[5].value, "c");
+
+    // Diagnostics point at the offending character on its own line.
+    ASSERT_EQ(diagnostics.size(), 1);
+    ASSERT_EQ(diagnostics.begin()->source, (Source{4, 0}));
+
+    auto cursor = TokenCursor{tokens};
+    for (const auto& token : tokens.tokens()) {
+        ASSERT_EQ(cursor.peek_type(), token.type);
+        ASSERT_EQ(cursor.pop(), token);
+    }
+    ASSERT_TRUE(cursor.empty());
+}
+
+TEST(LexerTest, TestKeywordTable) {
+    for (const auto& keyword : KEYWORDS) {
+        ASSERT_EQ(keyword_type(keyword.spelling), keyword.type);
+
+        const auto spelling = std::string(keyword.spelling);
+        ASSERT_EQ(keyword_type(spelling + "s"), std::nullopt);
+        ASSERT_EQ(keyword_type(spelling.substr(1)), std::nullopt);
+        ASSERT_EQ(keyword_type("x" + spelling.substr(1)), std::nullopt);
+    }
+    ASSERT_EQ(keyword_type("main"), std::nullopt);
+    ASSERT_EQ(keyword_type(""), std::nullopt);
+}
+
+// Random text made of long runs, so that runs start and end at every offset
+// within the 16 and 32 byte blocks the vector kernels work on.
+auto random_source(std::mt19937& random, size_t pieces) -> std::string {
+    static constexpr std::string_view identifier_chars =
+        "abcxyzABCXYZ0123456789_";
+    static constexpr std::string_view punctuation = "(){}=:,.<>-";
+
+    const auto below = [&](size_t bound) {
+        return std::uniform_int_distribution<size_t>{0, bound - 1}(random);
+    };
+
+    std::string source;
+    for (size_t piece = 0; piece < pieces; ++piece) {
+        switch (below(7)) {
+        case 0:
+            source.append(below(40), ' ');
+            break;
+        case 1:
+            source += 'a';
+            for (auto i = below(70); i > 0; --i) {
+                source += identifier_chars[below(identifier_chars.size())];
+            }
+            break;
+        case 2:
+            for (auto i = below(50) + 1; i > 0; --i) {
+                source += static_cast<char>('0' + below(10));
+            }
+            break;
+        case 3:
+            source += '"';
+            for (auto i = below(80); i > 0; --i) {
+                const auto c = static_cast<char>(below(256));
+                source += c == '"' ? '\'' : c;
+            }
+            source += '"';
+            break;
+        case 4:
+            source += punctuation[below(punctuation.size())];
+            break;
+        case 5:
+            source += '\n';
+            break;
+        default:
+            source += "fn";
+            break;
+        }
+    }
+    return source;
+}
+
+TEST(LexerTest, TestScanKernelsMatchScalar) {
+    auto random = std::mt19937{42};
+    const auto& scalar = scan_kernels(ScanIsa::scalar);
+
+    for (int round = 0; round < 200; ++round) {
+        const auto source = random_source(random, 40);
+        for (const auto isa : {ScanIsa::sse2, ScanIsa::avx2}) {
+            const auto& kernels = scan_kernels(isa);
+            for (size_t position = 0; position <= source.size(); ++position) {
+                ASSERT_EQ(kernels.skip_spaces(source, position),
+                          scalar.skip_spaces(source, position));
+                ASSERT_EQ(kernels.identifier_end(source, position),
+                          scalar.identifier_end(source, position));
+                ASSERT_EQ(kernels.digits_end(source, position),
+                          scalar.digits_end(source, position));
+                ASSERT_EQ(kernels.find_quote(source, position),
+                          scalar.find_quote(source, position));
+            }
+        }
+    }
+}
+
+TEST(LexerTest, TestVectorTokenizationMatchesScalar) {
+    auto random = std::mt19937{7};
+
+    for (int round = 0; round < 200; ++round) {
+        const auto source = random_source(random, 200);
+
+        auto scalar_diagnostics = Diagnostics{};
+        const auto expected =
+            lex(source, scalar_diagnostics, ScanIsa::scalar).tokens();
+
+        for (const auto isa : {ScanIsa::sse2, ScanIsa::avx2}) {
+            auto diagnostics = Diagnostics{};
+            ASSERT_EQ(lex(source, diagnostics, isa).tokens(), expected) << isa;
+            ASSERT_EQ(diagnostics.size(), scalar_diagnostics.size()) << isa;
+        }
+    }
+}
+
+TEST(LexerTest, TestLexerCursorMatchesTokenStream) {
+    auto random = std::mt19937{11};
+
+    for (int round = 0; round < 50; ++round) {
+        auto source = random_source(random, 100);
+        // Newlines, including some inside string literals.
+        for (size_t i = 7; i < source.size(); i += 13) {
+            source[i] = '\n';
+        }
+
+        auto stream_diagnostics = Diagnostics{};
+        const auto expected = lex(source, stream_diagnostics).tokens();
+
+        auto diagnostics = Diagnostics{};
+        auto lexer = Lexer{source, diagnostics};
+        auto cursor = LexerCursor{lexer};
+        for (const auto& token : expected) {
+            ASSERT_EQ(cursor.peek_type(1).has_value(),
+                      &token != &expected.back());
+            ASSERT_EQ(cursor.pop(), token);
+        }
+        ASSERT_TRUE(cursor.empty());
+        ASSERT_EQ(diagnostics.size(), stream_diagnostics.size());
+    }
+}
+
+TEST(LexerTest, TestParallelLexingMatchesSerial) {
+    auto random = std::mt19937{13};
+    auto pool = ThreadPool{4};
+
+    for (int round = 0; round < 50; ++round) {
+        auto source = random_source(random, 200);
+        for (size_t i = 5; i < source.size(); i += 11) {
+            source[i] = '\n';
+        }
+
+        auto serial_diagnostics = Diagnostics{};
+        const auto serial = lex(source, serial_diagnostics);
+
+        for (const size_t chunk_size : {1, 16, 64, 1024}) {
+            auto diagnostics = Diagnostics{};
+            const auto parallel =
+                lex_parallel(source, diagnostics, pool, chunk_size);
+            ASSERT_EQ(parallel.tokens(), serial.tokens()) << chunk_size;
+            ASSERT_EQ(parallel.line_index().size(),
+                      serial.line_index().size());
+
+            ASSERT_EQ(diagnostics.size(), serial_diagnostics.size());
+            auto expected = serial_diagnostics.begin();
+            for (const auto& diagnostic : diagnostics) {
+                ASSERT_EQ(diagnostic.message, expected->message);
+                ASSERT_EQ(diagnostic.source, expected->source);
+                ++expected;
+            }
+        }
+    }
+}
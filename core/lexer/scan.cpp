@@ -0,0 +1,174 @@
+#include "scan.h"
+#include <algorithm>
+#include <bit>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XLANG_SCAN_X86 1
+#include <immintrin.h>
+#else
+#define XLANG_SCAN_X86 0
+#endif
+
+using namespace xlang;
+
+namespace {
+
+constexpr auto is_space(char c) -> bool { return c == ' '; }
+
+constexpr auto is_not_quote(char c) -> bool { return c != '"'; }
+
+template <auto Matches>
+auto scalar_scan(std::string_view input, size_t position) -> size_t {
+    while (position < input.size() && Matches(input[position])) {
+        ++position;
+    }
+    return position;
+}
+
+constexpr auto SCALAR_KERNELS = ScanKernels{
+    .skip_spaces = scalar_scan<is_space>,
+    .identifier_end = scalar_scan<is_identifier_char>,
+    .digits_end = scalar_scan<is_digit>,
+    .find_quote = scalar_scan<is_not_quote>,
+};
+
+#if XLANG_SCAN_X86
+
+// The vector kernels compute a bit mask of the bytes in a block that continue
+// the run, then finish the last partial block with the scalar kernel. Range
+// checks use signed byte compares, which is fine because every range is ASCII
+// and bytes >= 0x80 compare as negative.
+
+auto sse2_in_range(__m128i chunk, char low, char high) -> __m128i {
+    return _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8(char(low - 1))),
+                         _mm_cmplt_epi8(chunk, _mm_set1_epi8(char(high + 1))));
+}
+
+auto sse2_space_mask(__m128i chunk) -> unsigned {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')));
+}
+
+auto sse2_identifier_mask(__m128i chunk) -> unsigned {
+    // Setting 0x20 folds upper case letters onto lower case ones.
+    const auto lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    const auto matches =
+        _mm_or_si128(_mm_or_si128(sse2_in_range(lower, 'a', 'z'),
+                                  sse2_in_range(chunk, '0', '9')),
+                     _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')));
+    return _mm_movemask_epi8(matches);
+}
+
+auto sse2_digit_mask(__m128i chunk) -> unsigned {
+    return _mm_movemask_epi8(sse2_in_range(chunk, '0', '9'));
+}
+
+auto sse2_not_quote_mask(__m128i chunk) -> unsigned {
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))) &
+           0xFFFFU;
+}
+
+template <auto Mask, auto Matches>
+auto sse2_scan(std::string_view input, size_t position) -> size_t {
+    constexpr size_t width = 16;
+    while (position + width <= input.size()) {
+        const auto chunk = _mm_loadu_si128(
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            reinterpret_cast<const __m128i*>(input.data() + position));
+        const auto ends = ~Mask(chunk) & 0xFFFFU;
+        if (ends != 0) {
+            return position + std::countr_zero(ends);
+        }
+        position += width;
+    }
+    return scalar_scan<Matches>(input, position);
+}
+
+constexpr auto SSE2_KERNELS = ScanKernels{
+    .skip_spaces = sse2_scan<sse2_space_mask, is_space>,
+    .identifier_end = sse2_scan<sse2_identifier_mask, is_identifier_char>,
+    .digits_end = sse2_scan<sse2_digit_mask, is_digit>,
+    .find_quote = sse2_scan<sse2_not_quote_mask, is_not_quote>,
+};
+
+#define XLANG_AVX2 __attribute__((target("avx2")))
+
+XLANG_AVX2 auto avx2_in_range(__m256i chunk, char low, char high) -> __m256i {
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(chunk, _mm256_set1_epi8(char(low - 1))),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(char(high + 1)), chunk));
+}
+
+XLANG_AVX2 auto avx2_space_mask(__m256i chunk) -> unsigned {
+    return _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')));
+}
+
+XLANG_AVX2 auto avx2_identifier_mask(__m256i chunk) -> unsigned {
+    const auto lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+    const auto matches =
+        _mm256_or_si256(_mm256_or_si256(avx2_in_range(lower, 'a', 'z'),
+                                        avx2_in_range(chunk, '0', '9')),
+                        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_')));
+    return _mm256_movemask_epi8(matches);
+}
+
+XLANG_AVX2 auto avx2_digit_mask(__m256i chunk) -> unsigned {
+    return _mm256_movemask_epi8(avx2_in_range(chunk, '0', '9'));
+}
+
+XLANG_AVX2 auto avx2_not_quote_mask(__m256i chunk) -> unsigned {
+    return ~_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"')));
+}
+
+template <auto Mask, auto Matches>
+XLANG_AVX2 auto avx2_scan(std::string_view input, size_t position) -> size_t {
+    constexpr size_t width = 32;
+    while (position + width <= input.size()) {
+        const auto chunk = _mm256_loadu_si256(
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            reinterpret_cast<const __m256i*>(input.data() + position));
+        const auto ends = ~Mask(chunk);
+        if (ends != 0) {
+            return position + std::countr_zero(ends);
+        }
+        position += width;
+    }
+    return scalar_scan<Matches>(input, position);
+}
+
+constexpr auto AVX2_KERNELS = ScanKernels{
+    .skip_spaces = avx2_scan<avx2_space_mask, is_space>,
+    .identifier_end = avx2_scan<avx2_identifier_mask, is_identifier_char>,
+    .digits_end = avx2_scan<avx2_digit_mask, is_digit>,
+    .find_quote = avx2_scan<avx2_not_quote_mask, is_not_quote>,
+};
+
+#undef XLANG_AVX2
+
+#endif
+
+} // namespace
+
+auto xlang::best_scan_isa() -> ScanIsa {
+#if XLANG_SCAN_X86
+    static const auto isa =
+        __builtin_cpu_supports("avx2") != 0 ? ScanIsa::avx2 : ScanIsa::sse2;
+    return isa;
+#else
+    return ScanIsa::scalar;
+#endif
+}
+
+auto xlang::scan_kernels(ScanIsa isa) -> const ScanKernels& {
+    switch (std::min(isa, best_scan_isa())) {
+#if XLANG_SCAN_X86
+    case ScanIsa::avx2:
+        return AVX2_KERNELS;
+    case ScanIsa::sse2:
+        return SSE2_KERNELS;
+#endif
+    default:
+        return SCALAR_KERNELS;
+    }
+}
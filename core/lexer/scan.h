@@ -0,0 +1,47 @@
+#pragma once
+
+#include "core/util/enum.h"
+#include <cstddef>
+#include <string_view>
+
+namespace xlang {
+
+// ASCII-only character classes. Unlike <cctype> these don't depend on the
+// locale, and bytes outside ASCII never match.
+constexpr auto is_alpha(char c) -> bool {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr auto is_digit(char c) -> bool { return c >= '0' && c <= '9'; }
+
+constexpr auto is_identifier_char(char c) -> bool {
+    return is_alpha(c) || is_digit(c) || c == '_';
+}
+
+// Instruction sets the scanning kernels are implemented for, in order of
+// preference.
+ENUM_CLASS(ScanIsa, scalar, sse2, avx2);
+
+// Each kernel starts at `position` and returns the offset of the first byte in
+// `input` that ends the run, or `input.size()` if the run reaches the end.
+using ScanKernel = auto (*)(std::string_view input, size_t position) -> size_t;
+
+struct ScanKernels {
+    // Runs of ' '.
+    ScanKernel skip_spaces;
+    // Runs of [A-Za-z0-9_].
+    ScanKernel identifier_end;
+    // Runs of [0-9].
+    ScanKernel digits_end;
+    // Runs of anything but '"'.
+    ScanKernel find_quote;
+};
+
+// Best instruction set supported by the running CPU.
+auto best_scan_isa() -> ScanIsa;
+
+// Kernels for `isa`, or for the best supported instruction set below it if the
+// CPU can't run `isa`. All variants return identical results.
+auto scan_kernels(ScanIsa isa) -> const ScanKernels&;
+
+} // namespace xlang
@@ -2,10 +2,10 @@
 
 #include "core/util/enum.h"
 #include <iostream>
-#include <string>
-#include <variant>
+#include <string_view>
 
 #include "core/util/source.h"
+#include "core/util/symbol.h"
 
 namespace xlang {
 
@@ -14,24 +14,47 @@ ENUM_CLASS(TokenType, function, variable, external, structure, equal, colon,
            angle_close, identifier, string_literal, integer_literal, new_line,
            dot, arrow, _return, variadic, unknown);
 
+// Identifier, literal and unknown tokens carry a view of their text. The view
+// points into the buffer that was lexed, which must outlive the token.
+// Identifiers are also interned, so later stages can compare their symbols.
 struct Token {
     TokenType type;
-    std::variant<std::monostate, std::string> value;
+    Symbol symbol;
+    std::string_view value;
     Source source;
 
     Token(TokenType type, Source source) : type{type}, source{source} {}
-    Token(TokenType type, std::string string, Source source)
-        : type{type}, value(string), source{source} {}
+    Token(TokenType type, std::string_view value, Source source)
+        : type{type},
+          symbol{type == TokenType::identifier ? intern(value) : Symbol{}},
+          value{value}, source{source} {}
 
     auto operator==(const Token& other) const -> bool = default;
 };
 
+// The text a token carries, given the whole `lexeme` it was lexed from: the
+// lexeme itself for identifiers, integers and unknown characters, the contents
+// for string literals, and nothing for keywords and punctuation.
+constexpr auto token_value(TokenType type, std::string_view lexeme)
+    -> std::string_view {
+    switch (type) {
+    case TokenType::identifier:
+    case TokenType::integer_literal:
+    case TokenType::unknown:
+        return lexeme;
+    case TokenType::string_literal:
+        return lexeme.substr(1, lexeme.size() - 2);
+    default:
+        return {};
+    }
+}
+
 inline auto operator<<(std::ostream& os, const Token& token) -> std::ostream& {
     os << token.type;
     switch (token.type) {
     case TokenType::identifier:
     case TokenType::string_literal:
-        os << "(" << std::get<std::string>(token.value) << ")";
+        os << "(" << token.value << ")";
         break;
     default:
         break;
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "core/util/source.h"
+#include "core/util/symbol.h"
+#include "token.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <string_view>
+#include <vector>
+
+namespace xlang {
+
+// Byte offsets at which the lines of a file start. Built once while lexing so
+// that line and column numbers can be computed on demand instead of being
+// tracked for every character.
+class LineIndex {
+  public:
+    LineIndex() : starts{0} {}
+
+    // Records that a new line starts at `offset`. Offsets must increase.
+    auto add_line(uint32_t offset) -> void { starts.push_back(offset); }
+
+    [[nodiscard]] auto source(uint32_t offset) const -> Source {
+        const auto next =
+            std::upper_bound(starts.begin(), starts.end(), offset);
+        const auto line = static_cast<size_t>(next - starts.begin()) - 1;
+        return at(line, offset);
+    }
+
+    // Like source(), but starts looking from `line`, which it updates. Cheap
+    // for callers that walk offsets in increasing order.
+    [[nodiscard]] auto source(uint32_t offset, size_t& line) const -> Source {
+        if (line >= starts.size() || starts[line] > offset) {
+            return source_and_line(offset, line);
+        }
+        while (line + 1 < starts.size() && starts[line + 1] <= offset) {
+            ++line;
+        }
+        return at(line, offset);
+    }
+
+    // Appends the lines of a file that was indexed on its own and starts at
+    // `base`, itself the start of a line already recorded here.
+    auto append(const LineIndex& other, uint32_t base) -> void {
+        for (size_t line = 1; line < other.starts.size(); ++line) {
+            starts.push_back(other.starts[line] + base);
+        }
+    }
+
+    [[nodiscard]] auto size() const -> size_t { return starts.size(); }
+
+    [[nodiscard]] auto operator[](size_t line) const -> uint32_t {
+        return starts[line];
+    }
+
+  private:
+    [[nodiscard]] auto at(size_t line, uint32_t offset) const -> Source {
+        return Source{static_cast<int>(line),
+                      static_cast<int>(offset - starts[line])};
+    }
+
+    [[nodiscard]] auto source_and_line(uint32_t offset, size_t& line) const
+        -> Source {
+        const auto next =
+            std::upper_bound(starts.begin(), starts.end(), offset);
+        line = static_cast<size_t>(next - starts.begin()) - 1;
+        return at(line, offset);
+    }
+
+    std::vector<uint32_t> starts;
+};
+
+// The tokens of one file, stored as parallel arrays of kinds, byte offsets and
+// lengths (plus the interned symbol of identifiers) so that scanning kinds
+// touches one cache line per several tokens. Full Token values, including
+// their line and column, are materialized on demand.
+//
+// Offsets are 32-bit, so a single file is limited to 4 GiB. The stream views
+// into the lexed text, which must outlive it.
+class TokenStream {
+  public:
+    using value_type = Token;
+
+    explicit TokenStream(std::string_view text) : text{text} {}
+
+    // `offset` and `length` cover the whole lexeme, including the quotes of
+    // string literals.
+    auto push(TokenType type, uint32_t offset, uint32_t length,
+              Symbol symbol = {}) -> void {
+        types.push_back(static_cast<uint8_t>(type));
+        offsets.push_back(offset);
+        lengths.push_back(length);
+        symbols.push_back(symbol);
+    }
+
+    auto set_line_index(LineIndex line_index) -> void {
+        lines = std::move(line_index);
+    }
+
+    // Appends the tokens of `other`, which was lexed from the slice of this
+    // stream's text that starts at `base`, at the start of a line.
+    auto append(const TokenStream& other, uint32_t base) -> void {
+        types.insert(types.end(), other.types.begin(), other.types.end());
+        for (const auto offset : other.offsets) {
+            offsets.push_back(offset + base);
+        }
+        lengths.insert(lengths.end(), other.lengths.begin(),
+                       other.lengths.end());
+        symbols.insert(symbols.end(), other.symbols.begin(),
+                       other.symbols.end());
+        lines.append(other.lines, base);
+    }
+
+    auto reserve(size_t tokens) -> void {
+        types.reserve(tokens);
+        offsets.reserve(tokens);
+        lengths.reserve(tokens);
+        symbols.reserve(tokens);
+    }
+
+    [[nodiscard]] auto size() const -> size_t { return types.size(); }
+
+    [[nodiscard]] auto empty() const -> bool { return types.empty(); }
+
+    [[nodiscard]] auto type(size_t index) const -> TokenType {
+        return static_cast<TokenType>(types[index]);
+    }
+
+    [[nodiscard]] auto offset(size_t index) const -> uint32_t {
+        return offsets[index];
+    }
+
+    [[nodiscard]] auto length(size_t index) const -> uint32_t {
+        return lengths[index];
+    }
+
+    [[nodiscard]] auto symbol(size_t index) const -> Symbol {
+        return symbols[index];
+    }
+
+    [[nodiscard]] auto value(size_t index) const -> std::string_view {
+        return token_value(type(index),
+                           text.substr(offsets[index], lengths[index]));
+    }
+
+    [[nodiscard]] auto source(size_t index) const -> Source {
+        return lines.source(offsets[index]);
+    }
+
+    [[nodiscard]] auto token(size_t index, Source source) const -> Token {
+        auto token = Token{type(index), source};
+        token.symbol = symbols[index];
+        token.value = value(index);
+        return token;
+    }
+
+    [[nodiscard]] auto operator[](size_t index) const -> Token {
+        return token(index, source(index));
+    }
+
+    // Materializes every token, mostly for tests and debugging.
+    [[nodiscard]] auto tokens() const -> std::vector<Token> {
+        std::vector<Token> result;
+        result.reserve(size());
+        size_t line = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            result.push_back(token(i, lines.source(offsets[i], line)));
+        }
+        return result;
+    }
+
+    [[nodiscard]] auto line_index() const -> const LineIndex& { return lines; }
+
+    [[nodiscard]] auto source_text() const -> std::string_view { return text; }
+
+  private:
+    std::string_view text;
+    std::vector<uint8_t> types;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<Symbol> symbols;
+    LineIndex lines;
+};
+
+// Reads a TokenStream front to back with Buffer's interface. Peeking at kinds
+// only touches the kinds array; popping materializes a Token, with its line
+// found incrementally.
+class TokenCursor {
+  public:
+    explicit TokenCursor(const TokenStream& tokens)
+        : tokens{&tokens}, end{tokens.size()} {}
+
+    // Reads only the tokens in [begin, end), as if there were no others.
+    TokenCursor(const TokenStream& tokens, size_t begin, size_t end)
+        : tokens{&tokens}, position{begin}, end{end},
+          line{std::numeric_limits<size_t>::max()} {}
+
+    [[nodiscard]] auto empty() const -> bool { return position >= end; }
+
+    [[nodiscard]] auto peek_type(int skip = 0) const
+        -> std::optional<TokenType> {
+        if (position + skip >= end) {
+            return std::nullopt;
+        }
+        return tokens->type(position + skip);
+    }
+
+    [[nodiscard]] auto safe_peek(int skip = 0) const -> std::optional<Token> {
+        if (position + skip >= end) {
+            return std::nullopt;
+        }
+        return materialize(position + skip);
+    }
+
+    auto safe_pop() -> std::optional<Token> {
+        if (empty()) {
+            return std::nullopt;
+        }
+        return materialize(position++);
+    }
+
+    [[nodiscard]] auto peek() const -> Token { return safe_peek().value(); }
+
+    auto pop() -> Token { return safe_pop().value(); }
+
+  private:
+    [[nodiscard]] auto materialize(size_t index) const -> Token {
+        return tokens->token(
+            index, tokens->line_index().source(tokens->offset(index), line));
+    }
+
+    const TokenStream* tokens;
+    size_t position = 0;
+    size_t end;
+    // Line of the last materialized token, where the next lookup starts. Out
+    // of range until then for cursors that start mid-stream, so that the
+    // first lookup is a binary search.
+    mutable size_t line = 0;
+};
+
+} // namespace xlang
@@ -0,0 +1,234 @@
+#include "core/llvmir/emit.h"
+#include "core/ir/ir.h"
+#include "core/llvmir/llvmir.h"
+#include "core/llvmir/optimize.h"
+#include "core/util/diagnostics.h"
+#include "core/util/trace.h"
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/CodeGen/ParallelCG.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/Program.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace xlang;
+using namespace xlang::llvmir;
+
+auto xlang::llvmir::emit(llvm::Module& llvm_module, OutputKind kind,
+                         llvm::TargetMachine& machine,
+                         llvm::raw_pwrite_stream& output,
+                         Diagnostics& diagnostics) -> bool {
+    llvm_module.setTargetTriple(machine.getTargetTriple().str());
+    llvm_module.setDataLayout(machine.createDataLayout());
+
+    switch (kind) {
+    case OutputKind::ir:
+        llvm_module.print(output, nullptr);
+        return true;
+    case OutputKind::bitcode:
+        llvm::WriteBitcodeToFile(llvm_module, output);
+        return true;
+    case OutputKind::assembly:
+    case OutputKind::object:
+        break;
+    case OutputKind::count:
+        return false;
+    }
+
+    llvm::legacy::PassManager passes;
+    const auto file_type = kind == OutputKind::object ? llvm::CGFT_ObjectFile
+                                                      : llvm::CGFT_AssemblyFile;
+    if (machine.addPassesToEmitFile(passes, output, nullptr, file_type)) {
+        diagnostics.push_error(
+            "Target can't emit " + OutputKind_to_string(kind), Source{});
+        return false;
+    }
+    passes.run(llvm_module);
+    return true;
+}
+
+namespace {
+
+// Generates code for the partitions of `llvm_module` at once, each in its own
+// LLVMContext on its own thread, and links the objects into the one at
+// `path`.
+auto emit_partitions(llvm::Module& llvm_module, const std::string& path,
+                     size_t partitions, OptimizationLevel level,
+                     Diagnostics& diagnostics) -> bool {
+    auto temporaries = std::vector<llvm::SmallString<128>>{};
+    const auto cleanup = llvm::make_scope_exit([&] {
+        for (const auto& temporary : temporaries) {
+            llvm::sys::fs::remove(temporary);
+        }
+    });
+    const auto temporary = [&](llvm::StringRef suffix,
+                               int& fd) -> std::optional<std::string> {
+        auto& name = temporaries.emplace_back();
+        if (const auto error = llvm::sys::fs::createTemporaryFile(
+                "xlang", suffix, fd, name)) {
+            diagnostics.push_error(
+                "Could not create a temporary file: " + error.message(),
+                Source{});
+            return std::nullopt;
+        }
+        return name.str().str();
+    };
+
+    const auto ld = llvm::sys::findProgramByName("ld");
+    if (!ld) {
+        diagnostics.push_error("Could not find ld to link partitions with",
+                               Source{});
+        return false;
+    }
+
+    auto objects = std::vector<std::string>{};
+    auto streams = std::vector<std::unique_ptr<llvm::raw_fd_ostream>>{};
+    auto outputs = std::vector<llvm::raw_pwrite_stream*>{};
+    for (size_t i = 0; i < partitions; ++i) {
+        int fd = -1;
+        const auto object = temporary("o", fd);
+        if (!object.has_value()) {
+            return false;
+        }
+        objects.push_back(object.value());
+        outputs.push_back(streams
+                              .emplace_back(std::make_unique<
+                                            llvm::raw_fd_ostream>(fd, true))
+                              .get());
+    }
+
+    XLANG_TRACE(llvm, info,
+                "Generating code in " << partitions << " partitions");
+    llvm::splitCodeGen(
+        llvm_module, outputs, {},
+        [level] {
+            // Already made once for the whole module, so this can't fail.
+            auto unused = Diagnostics{};
+            return host_target_machine(level, unused);
+        },
+        llvm::CGFT_ObjectFile);
+    for (auto& stream : streams) {
+        stream->close();
+        if (stream->has_error()) {
+            diagnostics.push_error("Could not write a partition: " +
+                                       stream->error().message(),
+                                   Source{});
+            stream->clear_error();
+            return false;
+        }
+    }
+
+    // ld seeks within its output, so stdout gets a copy of a file.
+    auto linked = path;
+    if (path == "-") {
+        int fd = -1;
+        const auto file = temporary("o", fd);
+        if (!file.has_value()) {
+            return false;
+        }
+        llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+        linked = file.value();
+    }
+
+    auto args = std::vector<llvm::StringRef>{ld.get(), "-r", "-o", linked};
+    args.insert(args.end(), objects.begin(), objects.end());
+    std::string error;
+    if (llvm::sys::ExecuteAndWait(ld.get(), args, std::nullopt, {}, 0, 0,
+                                  &error) != 0) {
+        diagnostics.push_error("Could not link partitions: " + error,
+                               Source{});
+        return false;
+    }
+
+    if (path == "-") {
+        const auto contents = llvm::MemoryBuffer::getFile(linked);
+        if (!contents) {
+            diagnostics.push_error("Could not read the linked object: " +
+                                       contents.getError().message(),
+                                   Source{});
+            return false;
+        }
+        llvm::outs() << contents.get()->getBuffer();
+        llvm::outs().flush();
+    }
+    return true;
+}
+
+} // namespace
+
+auto xlang::llvmir::emit(const ir::Module& module, const Output& output,
+                         const OptimizationOptions& optimization,
+                         Diagnostics& diagnostics) -> bool {
+    const auto kind = output.kind;
+    const auto& path = output.path;
+    llvm::LLVMContext context;
+    const auto reported = diagnostics.size();
+    const auto llvm_module = translate(module, context, diagnostics);
+    // What failed to translate has been left out of the module.
+    if (!llvm_module || diagnostics.size() > reported) {
+        return false;
+    }
+    // Writers assume a well-formed module, and some crash on anything else.
+    if (!verify(*llvm_module, diagnostics)) {
+        return false;
+    }
+    const auto machine = host_target_machine(optimization.level, diagnostics);
+    if (!machine) {
+        return false;
+    }
+    // Optimized as a whole even when code is generated in partitions, since
+    // inlining and dropping unused functions need to see every caller.
+    // Code generation is where the time goes, and that's what's split.
+    optimize(*llvm_module, *machine, optimization);
+    if (kind == OutputKind::object && output.threads > 1) {
+        return emit_partitions(*llvm_module, path, output.threads,
+                               optimization.level, diagnostics);
+    }
+
+    // "-" opens stdout.
+    std::error_code error;
+    llvm::raw_fd_ostream stream{path, error,
+                                kind == OutputKind::ir ||
+                                        kind == OutputKind::assembly
+                                    ? llvm::sys::fs::OF_Text
+                                    : llvm::sys::fs::OF_None};
+    if (error) {
+        diagnostics.push_error("Could not open " + path + ": " +
+                                   error.message(),
+                               Source{});
+        return false;
+    }
+    // Object writers may seek back to patch what they've written, which
+    // pipes can't do, so output to a pipe is buffered until the end.
+    std::optional<llvm::buffer_ostream> buffer;
+    if (!stream.supportsSeeking()) {
+        buffer.emplace(stream);
+    }
+    if (!emit(*llvm_module, kind, *machine,
+              buffer.has_value() ? static_cast<llvm::raw_pwrite_stream&>(
+                                       buffer.value())
+                                 : stream,
+              diagnostics)) {
+        return false;
+    }
+    buffer.reset();
+
+    stream.flush();
+    if (stream.has_error()) {
+        diagnostics.push_error("Could not write " + path + ": " +
+                                   stream.error().message(),
+                               Source{});
+        stream.clear_error();
+        return false;
+    }
+    return true;
+}
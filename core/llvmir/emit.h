@@ -0,0 +1,44 @@
+#pragma once
+
+#include "core/ir/ir.h"
+#include "core/llvmir/optimize.h"
+#include "core/util/diagnostics.h"
+#include "core/util/enum.h"
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <cstddef>
+#include <string>
+
+namespace xlang::llvmir {
+
+// What emit() writes: textual LLVM IR, LLVM bitcode, native assembly or a
+// native object file.
+ENUM_CLASS(OutputKind, ir, bitcode, assembly, object);
+
+// Where emit() writes and how.
+struct Output {
+    OutputKind kind = OutputKind::ir;
+    // "-" is stdout.
+    std::string path = "-";
+    // Objects are generated in this many partitions of the module at once,
+    // which are then linked into one with `ld -r`.
+    size_t threads = 1;
+};
+
+// Writes `llvm_module` to `output` as `kind`. Native output is generated by
+// `machine`, which the module's triple and data layout are set from, and may
+// seek within `output`. Returns false, with a diagnostic, if nothing could be
+// written.
+auto emit(llvm::Module& llvm_module, OutputKind kind,
+          llvm::TargetMachine& machine, llvm::raw_pwrite_stream& output,
+          Diagnostics& diagnostics) -> bool;
+
+// Translates `module` for the host, optimizes it as `optimization` says and
+// writes it to `output`. The output is streamed to its file as it's
+// generated, unless it's an object generated in partitions.
+auto emit(const ir::Module& module, const Output& output,
+          const OptimizationOptions& optimization, Diagnostics& diagnostics)
+    -> bool;
+
+} // namespace xlang::llvmir
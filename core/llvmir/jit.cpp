@@ -0,0 +1,90 @@
+#include "core/llvmir/jit.h"
+#include "core/ir/ir.h"
+#include "core/llvmir/llvmir.h"
+#include "core/llvmir/optimize.h"
+#include "core/util/diagnostics.h"
+#include "core/util/trace.h"
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/Error.h>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+using namespace xlang;
+
+namespace {
+
+// Reports `error`, if there is one, and returns whether there was.
+auto failed(llvm::Error error, Diagnostics& diagnostics) -> bool {
+    if (!error) {
+        return false;
+    }
+    diagnostics.push_error("JIT: " + llvm::toString(std::move(error)),
+                           Source{});
+    return true;
+}
+
+} // namespace
+
+auto xlang::llvmir::run(const ir::Module& module,
+                        const OptimizationOptions& optimization,
+                        Diagnostics& diagnostics) -> std::optional<int> {
+    // Also sets up the native target for the JIT.
+    const auto machine = host_target_machine(optimization.level, diagnostics);
+    if (!machine) {
+        return std::nullopt;
+    }
+
+    // The JIT takes the context along with the module, so that it outlives
+    // the compiled code.
+    auto context = std::make_unique<llvm::LLVMContext>();
+    const auto reported = diagnostics.size();
+    auto llvm_module = translate(module, *context, diagnostics);
+    // What failed to translate has been left out of the module, and the JIT
+    // may assert on a module that isn't well formed.
+    if (!llvm_module || diagnostics.size() > reported ||
+        !verify(*llvm_module, diagnostics)) {
+        return std::nullopt;
+    }
+    optimize(*llvm_module, *machine, optimization);
+
+    auto jit = llvm::orc::LLJITBuilder().create();
+    if (failed(jit.takeError(), diagnostics)) {
+        return std::nullopt;
+    }
+
+    // Externs are looked up among the symbols of this process, libc
+    // included.
+    auto host = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        (*jit)->getDataLayout().getGlobalPrefix());
+    if (failed(host.takeError(), diagnostics)) {
+        return std::nullopt;
+    }
+    (*jit)->getMainJITDylib().addGenerator(std::move(host.get()));
+
+    if (failed((*jit)->addIRModule(llvm::orc::ThreadSafeModule(
+                   std::move(llvm_module), std::move(context))),
+               diagnostics)) {
+        return std::nullopt;
+    }
+
+    auto main = (*jit)->lookup(symbols::MAIN.str());
+    if (failed(main.takeError(), diagnostics)) {
+        return std::nullopt;
+    }
+
+    XLANG_TRACE(llvm, info, "Running main");
+    const auto return_type = module.functions.at(symbols::MAIN)->return_type;
+    if (return_type == ir::types::INT32) {
+        return main->toPtr<int()>()();
+    }
+    if (return_type == ir::types::INT64) {
+        return static_cast<int>(main->toPtr<int64_t()>()());
+    }
+    main->toPtr<void()>()();
+    return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "core/ir/ir.h"
+#include "core/llvmir/optimize.h"
+#include "core/util/diagnostics.h"
+#include <optional>
+
+namespace xlang::llvmir {
+
+// Compiles `module` in memory, optimized as `optimization` says, and calls
+// its main, resolving externs such as printf against this process. Returns
+// main's result as an exit status, or 0 if main returns nothing. Returns
+// std::nullopt, with diagnostics, if the module couldn't be compiled.
+auto run(const ir::Module& module, const OptimizationOptions& optimization,
+         Diagnostics& diagnostics) -> std::optional<int>;
+
+} // namespace xlang::llvmir
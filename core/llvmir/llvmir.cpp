@@ -1,57 +1,72 @@
 #include "core/llvmir/llvmir.h"
 #include "core/ir/ir.h"
 #include "core/util/diagnostics.h"
+#include "core/util/trace.h"
 #include <llvm-17/llvm/IR/Constant.h>
 #include <llvm-17/llvm/IR/Instructions.h>
 #include <llvm-17/llvm/IR/LLVMContext.h>
 #include <llvm-17/llvm/IR/Value.h>
+#include <llvm/IR/CallingConv.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 using namespace xlang;
 
-auto translate_type(const std::shared_ptr<ir::Type>& type,
-                    llvm::LLVMContext& context, Diagnostics& diagnostics)
+auto translate_primitive(ir::Primitive primitive, llvm::LLVMContext& context)
     -> llvm::Type* {
-
-    if (const auto void_type = std::dynamic_pointer_cast<ir::VoidType>(type)) {
-        return llvm::Type::getVoidTy(context);
-    }
-
-    if (const auto primitive_type =
-            std::dynamic_pointer_cast<ir::PrimitiveType>(type)) {
-        switch (primitive_type->primitive) {
-        case ir::Primitive::i8:
-        case ir::Primitive::u8:
-            return llvm::Type::getInt8Ty(context);
-        case ir::Primitive::i16:
-        case ir::Primitive::u16:
-            return llvm::Type::getInt16Ty(context);
-        case ir::Primitive::i32:
-        case ir::Primitive::u32:
-            return llvm::Type::getInt32Ty(context);
-        case ir::Primitive::i64:
-        case ir::Primitive::u64:
-            return llvm::Type::getInt64Ty(context);
-            return llvm::Type::getInt8Ty(context);
-        case ir::Primitive::f32:
-            return llvm::Type::getFloatTy(context);
-        case ir::Primitive::f64:
-            return llvm::Type::getDoubleTy(context);
-        default:
-            return nullptr;
-        }
-    }
-
-    if (const auto pointer_type =
-            std::dynamic_pointer_cast<ir::PointerType>(type)) {
-        return translate_type(pointer_type->pointee, context, diagnostics)
-            ->getPointerTo();
+    switch (primitive) {
+    case ir::Primitive::i8:
+    case ir::Primitive::u8:
+        return llvm::Type::getInt8Ty(context);
+    case ir::Primitive::i16:
+    case ir::Primitive::u16:
+        return llvm::Type::getInt16Ty(context);
+    case ir::Primitive::i32:
+    case ir::Primitive::u32:
+        return llvm::Type::getInt32Ty(context);
+    case ir::Primitive::i64:
+    case ir::Primitive::u64:
+        return llvm::Type::getInt64Ty(context);
+    case ir::Primitive::f32:
+        return llvm::Type::getFloatTy(context);
+    case ir::Primitive::f64:
+        return llvm::Type::getDoubleTy(context);
+    default:
+        return nullptr;
     }
+}
 
-    diagnostics.push_error("Unknown type", Source{});
-    return nullptr;
+auto translate_type(ir::TypeId id, const ir::TypeTable& types,
+                    llvm::LLVMContext& context, Diagnostics& diagnostics)
+    -> llvm::Type* {
+    return visit(
+        types[id],
+        Overloaded{
+            [&](const ir::VoidType& /*type*/) -> llvm::Type* {
+                return llvm::Type::getVoidTy(context);
+            },
+            [&](const ir::PrimitiveType& type) {
+                return translate_primitive(type.primitive, context);
+            },
+            [&](const ir::PointerType& type) -> llvm::Type* {
+                auto* const pointee =
+                    translate_type(type.pointee, types, context, diagnostics);
+                return pointee != nullptr ? pointee->getPointerTo() : nullptr;
+            },
+            [&](const ir::StructType& /*type*/) -> llvm::Type* {
+                diagnostics.push_error("Unknown type", Source{});
+                return nullptr;
+            },
+        });
 }
 
 auto translate_node(const std::shared_ptr<ir::IRNode>& node,
@@ -59,17 +74,51 @@ auto translate_node(const std::shared_ptr<ir::IRNode>& node,
                     llvm::IRBuilder<>& builder, Diagnostics& diagnostics)
     -> llvm::Value*;
 
+// Only main and externs are seen outside the module, so LLVM is free to
+// inline, change or drop every other function.
+auto linkage(const ir::Function& function) -> llvm::GlobalValue::LinkageTypes {
+    if (function.external || function.name == symbols::MAIN) {
+        return llvm::Function::ExternalLinkage;
+    }
+    return llvm::Function::InternalLinkage;
+}
+
 auto translate_function(const std::shared_ptr<ir::Function>& function,
                         const ir::Module& module, llvm::Module& llvm_module,
                         Diagnostics& diagnostics) -> llvm::Function* {
+    XLANG_TRACE(llvm, debug, "Translating function " << function->name);
+    auto& context = llvm_module.getContext();
+    auto parameter_types = std::vector<llvm::Type*>{};
+    parameter_types.reserve(function->parameters.size());
+    for (const auto& parameter : function->parameters) {
+        parameter_types.push_back(
+            translate_type(parameter.type, module.types, context, diagnostics));
+    }
+    auto* const return_type =
+        translate_type(function->return_type, module.types, context,
+                       diagnostics);
+    // The types that didn't translate have been reported already.
+    if (return_type == nullptr ||
+        std::find(parameter_types.begin(), parameter_types.end(), nullptr) !=
+            parameter_types.end()) {
+        return nullptr;
+    }
+
     auto* const llvm_function = llvm::Function::Create(
-        llvm::FunctionType::get(translate_type(function->return_type,
-                                               llvm_module.getContext(),
-                                               diagnostics),
-                                false),
-        llvm::Function::ExternalLinkage, function->name, &llvm_module);
+        llvm::FunctionType::get(return_type, parameter_types,
+                                function->variadic),
+        linkage(*function), function->name.str(), &llvm_module);
+    // Nothing outside the module calls internal functions, so they can use
+    // the cheapest convention LLVM has. It doesn't support varargs.
+    if (llvm_function->hasInternalLinkage() && !function->variadic) {
+        llvm_function->setCallingConv(llvm::CallingConv::Fast);
+    }
+    for (size_t i = 0; i < function->parameters.size(); ++i) {
+        llvm_function->getArg(i)->setName(
+            function->parameters[i].name.str());
+    }
 
-    if (!function->definition.external) {
+    if (!function->external) {
         auto* const entry = llvm::BasicBlock::Create(llvm_module.getContext(),
                                                      "entry", llvm_function);
 
@@ -79,9 +128,14 @@ auto translate_function(const std::shared_ptr<ir::Function>& function,
             translate_node(node, module, llvm_module, builder, diagnostics);
         }
         if (function->return_value) {
-            builder.CreateRet(translate_node(function->return_value, module,
-                                             llvm_module, builder,
-                                             diagnostics));
+            auto* const value = translate_node(function->return_value, module,
+                                               llvm_module, builder,
+                                               diagnostics);
+            // The failure has been reported, this only keeps the function
+            // well formed.
+            builder.CreateRet(value != nullptr
+                                  ? value
+                                  : llvm::UndefValue::get(return_type));
         } else {
             builder.CreateRetVoid();
         }
@@ -90,10 +144,10 @@ auto translate_function(const std::shared_ptr<ir::Function>& function,
     return llvm_function;
 }
 
-auto get_function(const std::string& name, const ir::Module& module,
+auto get_function(Symbol name, const ir::Module& module,
                   llvm::Module& llvm_module, Diagnostics& diagnostics)
     -> llvm::Function* {
-    auto* llvm_function = llvm_module.getFunction(name);
+    auto* llvm_function = llvm_module.getFunction(name.str());
     if (llvm_function == nullptr) {
         if (!module.functions.contains(name)) {
             return nullptr;
@@ -106,7 +160,7 @@ auto get_function(const std::string& name, const ir::Module& module,
     return llvm_function;
 }
 
-auto escape_string(const std::string& input) -> std::string {
+auto escape_string(std::string_view input) -> std::string {
     std::string output;
     bool escape = false;
 
@@ -142,63 +196,125 @@ auto escape_string(const std::string& input) -> std::string {
     return output;
 }
 
+namespace {
+
+// A call whose arguments are still being translated.
+struct PendingCall {
+    const ir::FunctionCallIRNode* node;
+    llvm::Function* function;
+    std::vector<llvm::Value*> arguments;
+};
+
+} // namespace
+
+// Calls can nest as deep as the parser allows, so nested calls wait on an
+// explicit stack rather than being translated recursively.
 auto translate_node(const std::shared_ptr<ir::IRNode>& node,
                     const ir::Module& module, llvm::Module& llvm_module,
                     llvm::IRBuilder<>& builder, Diagnostics& diagnostics)
     -> llvm::Value* {
-    if (const auto string_literal_node =
-            dynamic_pointer_cast<ir::StringLiteralIRNode>(node)) {
-        return builder.CreateGlobalStringPtr(
-            escape_string(string_literal_node->value.value));
-    }
-
-    if (const auto integer_literal_node =
-            dynamic_pointer_cast<ir::IntegerLiteralIRNode>(node)) {
-        return llvm::ConstantInt::get(
-            llvm::Type::getInt32Ty(builder.getContext()),
-            integer_literal_node->value.value, false);
-    }
-
-    if (const auto function_call_node =
-            dynamic_pointer_cast<ir::FunctionCallIRNode>(node)) {
+    auto calls = std::vector<PendingCall>{};
+    // A call only has a value once its arguments do, so it's pushed instead.
+    std::optional<llvm::Value*> value;
+    const auto start = Overloaded{
+        [&](const ir::FunctionCallIRNode& function_call_node) {
+            auto* const llvm_function =
+                get_function(function_call_node.function->name, module,
+                             llvm_module, diagnostics);
+            if (llvm_function == nullptr) {
+                // TODO: pass through source
+                diagnostics.push_error("Unknown function", Source{});
+                value = nullptr;
+                return;
+            }
+            calls.push_back({&function_call_node, llvm_function, {}});
+            calls.back().arguments.reserve(
+                function_call_node.arguments.size());
+        },
+        [&](const ir::StringLiteralIRNode& literal) {
+            value = builder.CreateGlobalStringPtr(
+                escape_string(literal.value.value));
+        },
+        [&](const ir::IntegerLiteralIRNode& literal) {
+            value = llvm::ConstantInt::get(
+                llvm::Type::getInt32Ty(builder.getContext()),
+                literal.value.value, false);
+        },
+    };
 
-        auto* const llvm_function =
-            get_function(function_call_node->function->name, module,
-                         llvm_module, diagnostics);
-        if (llvm_function == nullptr) {
-            // TODO: pass through source
-            diagnostics.push_error("Unknown function", Source{});
-            return nullptr;
+    const ir::IRNode* next = node.get();
+    while (true) {
+        value.reset();
+        if (next != nullptr) {
+            visit(*next, start);
+        } else {
+            diagnostics.push_error("Unknown IR node type", Source{});
+            value = nullptr;
         }
 
-        std::vector<llvm::Value*> llvm_args{};
-        llvm_args.reserve(function_call_node->arguments.size());
-        for (const auto& arg : function_call_node->arguments) {
-            llvm_args.push_back(
-                translate_node(arg, module, llvm_module, builder, diagnostics));
+        // Passes the value to the call waiting on it, finishing calls until
+        // one needs another argument.
+        while (true) {
+            if (value.has_value()) {
+                // A value that failed to translate fails every call waiting
+                // on it, up to the outermost one.
+                if (calls.empty() || value.value() == nullptr) {
+                    return value.value();
+                }
+                calls.back().arguments.push_back(value.value());
+            }
+            auto& call = calls.back();
+            const auto translated = call.arguments.size();
+            if (translated < call.node->arguments.size()) {
+                next = call.node->arguments[translated].get();
+                break;
+            }
+            auto* const instruction =
+                builder.CreateCall(call.function, call.arguments);
+            instruction->setCallingConv(call.function->getCallingConv());
+            value = instruction;
+            calls.pop_back();
         }
-        return builder.CreateCall(llvm_function, llvm_args);
+    }
+}
+
+auto xlang::llvmir::translate(const ir::Module& module,
+                              llvm::LLVMContext& context,
+                              Diagnostics& diagnostics)
+    -> std::unique_ptr<llvm::Module> {
+    if (!module.functions.contains(symbols::MAIN)) {
+        diagnostics.push_error("No main function", Source{});
+        return nullptr;
     }
 
-    diagnostics.push_error("Unknown IR node type", Source{});
-    return nullptr;
+    auto llvm_module = std::make_unique<llvm::Module>("xlang", context);
+    translate_function(module.functions.at(symbols::MAIN), module,
+                       *llvm_module, diagnostics);
+    return llvm_module;
+}
+
+auto xlang::llvmir::verify(const llvm::Module& llvm_module,
+                           Diagnostics& diagnostics) -> bool {
+    std::string problems;
+    llvm::raw_string_ostream stream{problems};
+    if (llvm::verifyModule(llvm_module, &stream)) {
+        diagnostics.push_error("Invalid LLVM module: " + stream.str(),
+                               Source{});
+        return false;
+    }
+    return true;
 }
 
 auto xlang::llvmir::print(const ir::Module& module, Diagnostics& diagnostics)
     -> std::string {
     llvm::LLVMContext context;
-    llvm::Module llvm_module("xlang", context);
-
-    if (!module.functions.contains("main")) {
-        diagnostics.push_error("No main function", Source{});
+    const auto llvm_module = translate(module, context, diagnostics);
+    if (!llvm_module) {
         return "";
     }
 
-    translate_function(module.functions.at("main"), module, llvm_module,
-                       diagnostics);
-
     std::string module_str;
     llvm::raw_string_ostream ostream(module_str);
-    llvm_module.print(ostream, nullptr);
+    llvm_module->print(ostream, nullptr);
     return ostream.str();
 }
\ No newline at end of file
@@ -2,10 +2,23 @@
 
 #include "core/ir/ir.h"
 #include "core/util/diagnostics.h"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <memory>
 #include <string>
 
 namespace xlang::llvmir {
 
+// Translates main and every function it reaches into an LLVM module owned by
+// `context`. Returns null, with a diagnostic, if `module` has no main.
+auto translate(const ir::Module& module, llvm::LLVMContext& context,
+               Diagnostics& diagnostics) -> std::unique_ptr<llvm::Module>;
+
+// Returns whether `llvm_module` is well formed, reporting what isn't if it's
+// not.
+auto verify(const llvm::Module& llvm_module, Diagnostics& diagnostics) -> bool;
+
+// The textual LLVM IR of translate()'s module.
 auto print(const ir::Module& module, Diagnostics& diagnostics) -> std::string;
 
 }
\ No newline at end of file
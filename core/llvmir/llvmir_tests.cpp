@@ -0,0 +1,34 @@
+#include "llvmir.h"
+#include "core/ir/ir.h"
+#include "core/lexer/lexer.h"
+#include "core/parser/parser.h"
+#include <gtest/gtest.h>
+#include <llvm/IR/CallingConv.h>
+#include <llvm/IR/LLVMContext.h>
+#include <string>
+
+using namespace xlang;
+
+// Internal functions use fastcc, except variadic ones, which it doesn't
+// support.
+TEST(LLVMIRTest, TestVariadicFunctionsKeepTheCConvention) {
+    const std::string program =
+        "fn log(format: Pointer<UInt8>, ...) {}\n"
+        "fn f(value: Int32) {}\n"
+        "fn main() { log(\"%d\", 1) f(2) }\n";
+    auto diagnostics = Diagnostics{};
+    auto ast = Ast{};
+    const auto roots = parse(lex(program, diagnostics), ast, diagnostics);
+    const auto module = ir::compile(ast, ast[roots], diagnostics);
+    ASSERT_EQ(diagnostics.size(), 0);
+
+    llvm::LLVMContext context;
+    const auto llvm_module = llvmir::translate(module, context, diagnostics);
+    ASSERT_NE(llvm_module, nullptr);
+    ASSERT_EQ(diagnostics.size(), 0);
+    ASSERT_TRUE(llvmir::verify(*llvm_module, diagnostics));
+    ASSERT_EQ(llvm_module->getFunction("log")->getCallingConv(),
+              llvm::CallingConv::C);
+    ASSERT_EQ(llvm_module->getFunction("f")->getCallingConv(),
+              llvm::CallingConv::Fast);
+}
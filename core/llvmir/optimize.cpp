@@ -0,0 +1,137 @@
+#include "core/llvmir/optimize.h"
+#include "core/util/diagnostics.h"
+#include "core/util/trace.h"
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+using namespace xlang;
+using namespace xlang::llvmir;
+
+namespace {
+
+auto codegen_level(OptimizationLevel level) -> llvm::CodeGenOpt::Level {
+    switch (level) {
+    case OptimizationLevel::O0:
+        return llvm::CodeGenOpt::None;
+    case OptimizationLevel::O1:
+        return llvm::CodeGenOpt::Less;
+    case OptimizationLevel::O3:
+        return llvm::CodeGenOpt::Aggressive;
+    case OptimizationLevel::O2:
+    case OptimizationLevel::Os:
+    case OptimizationLevel::count:
+        break;
+    }
+    return llvm::CodeGenOpt::Default;
+}
+
+auto pipeline_level(OptimizationLevel level) -> llvm::OptimizationLevel {
+    switch (level) {
+    case OptimizationLevel::O1:
+        return llvm::OptimizationLevel::O1;
+    case OptimizationLevel::O2:
+        return llvm::OptimizationLevel::O2;
+    case OptimizationLevel::O3:
+        return llvm::OptimizationLevel::O3;
+    case OptimizationLevel::Os:
+        return llvm::OptimizationLevel::Os;
+    case OptimizationLevel::O0:
+    case OptimizationLevel::count:
+        break;
+    }
+    return llvm::OptimizationLevel::O0;
+}
+
+// The host CPU's features, as "+sse4.2,-avx512f,...".
+auto host_features() -> std::string {
+    auto features = std::string{};
+    llvm::StringMap<bool> host;
+    if (!llvm::sys::getHostCPUFeatures(host)) {
+        return features;
+    }
+    for (const auto& feature : host) {
+        if (!features.empty()) {
+            features += ',';
+        }
+        features += feature.getValue() ? '+' : '-';
+        features += feature.getKey();
+    }
+    return features;
+}
+
+} // namespace
+
+auto xlang::llvmir::host_target_machine(OptimizationLevel level,
+                                        Diagnostics& diagnostics)
+    -> std::unique_ptr<llvm::TargetMachine> {
+    static std::once_flag native_target;
+    std::call_once(native_target, [] {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+    });
+
+    const auto triple = llvm::sys::getDefaultTargetTriple();
+    std::string error;
+    const auto* const target =
+        llvm::TargetRegistry::lookupTarget(triple, error);
+    if (target == nullptr) {
+        diagnostics.push_error("No target for " + triple + ": " + error,
+                               Source{});
+        return nullptr;
+    }
+
+    const auto cpu = llvm::sys::getHostCPUName();
+    XLANG_TRACE(llvm, info, "Targeting " << triple << " (" << cpu.str() << ")");
+    return std::unique_ptr<llvm::TargetMachine>{target->createTargetMachine(
+        triple, cpu, host_features(), llvm::TargetOptions{}, llvm::Reloc::PIC_,
+        std::nullopt, codegen_level(level))};
+}
+
+auto xlang::llvmir::optimize(llvm::Module& llvm_module,
+                             llvm::TargetMachine& machine,
+                             const OptimizationOptions& options) -> void {
+    llvm_module.setTargetTriple(machine.getTargetTriple().str());
+    llvm_module.setDataLayout(machine.createDataLayout());
+
+    llvm::PassInstrumentationCallbacks instrumentation;
+    llvm::TimePassesHandler timing{options.time_passes};
+    timing.registerCallbacks(instrumentation);
+
+    llvm::LoopAnalysisManager loop_analyses;
+    llvm::FunctionAnalysisManager function_analyses;
+    llvm::CGSCCAnalysisManager cgscc_analyses;
+    llvm::ModuleAnalysisManager module_analyses;
+    llvm::PassBuilder builder{&machine, llvm::PipelineTuningOptions{},
+                              std::nullopt, &instrumentation};
+    builder.registerModuleAnalyses(module_analyses);
+    builder.registerCGSCCAnalyses(cgscc_analyses);
+    builder.registerFunctionAnalyses(function_analyses);
+    builder.registerLoopAnalyses(loop_analyses);
+    builder.crossRegisterProxies(loop_analyses, function_analyses,
+                                 cgscc_analyses, module_analyses);
+
+    const auto level = pipeline_level(options.level);
+    auto passes = options.level == OptimizationLevel::O0
+                      ? builder.buildO0DefaultPipeline(level)
+                      : builder.buildPerModuleDefaultPipeline(level);
+    XLANG_TRACE(llvm, info, "Optimizing at " << options.level);
+    passes.run(llvm_module, module_analyses);
+
+    if (options.time_passes) {
+        timing.print();
+    }
+}
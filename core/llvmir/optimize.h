@@ -0,0 +1,32 @@
+#pragma once
+
+#include "core/util/diagnostics.h"
+#include "core/util/enum.h"
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+
+namespace xlang::llvmir {
+
+// LLVM's default pipelines, as picked by clang's -O flags.
+ENUM_CLASS(OptimizationLevel, O0, O1, O2, O3, Os);
+
+// How the backend optimizes what it generates.
+struct OptimizationOptions {
+    OptimizationLevel level = OptimizationLevel::O0;
+    // Reports how long each pass took to stderr.
+    bool time_passes = false;
+};
+
+// A TargetMachine for the host's triple, CPU and CPU features, generating
+// code at `level`. Returns null, with a diagnostic, if LLVM wasn't built for
+// the host.
+auto host_target_machine(OptimizationLevel level, Diagnostics& diagnostics)
+    -> std::unique_ptr<llvm::TargetMachine>;
+
+// Runs the default pipeline for `options.level` over `llvm_module`, tuned for
+// `machine`. Sets the module's triple and data layout from `machine` first.
+auto optimize(llvm::Module& llvm_module, llvm::TargetMachine& machine,
+              const OptimizationOptions& options) -> void;
+
+} // namespace xlang::llvmir
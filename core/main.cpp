@@ -1,64 +1,265 @@
 #include "ir/ir.h"
+#include "ir/passes.h"
 #include "lexer/lexer.h"
-#include "llvmir/llvmir.h"
+#include "llvmir/emit.h"
+#include "llvmir/jit.h"
+#include "parser/ast_cache.h"
 #include "parser/parser.h"
+#include "util/source_file.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 
-#include <fstream>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
 
 using namespace xlang;
 
+// Files at least this large are lexed and parsed in parallel; smaller ones are
+// lexed as the parser pulls tokens.
+constexpr size_t PARALLEL_LEX_THRESHOLD = 4 * PARALLEL_LEX_CHUNK_SIZE;
+
+// Lexes and parses `file` into `ast`, returning its top-level nodes.
+auto parse_file(const SourceFile& file, Ast& ast, Diagnostics& diagnostics,
+                ThreadPool& pool) -> Range<NodeId> {
+    if (file.contents().size() >= PARALLEL_LEX_THRESHOLD) {
+        const auto tokens = lex_parallel(file.contents(), diagnostics, pool);
+        return parse_parallel(tokens, ast, diagnostics, pool);
+    }
+    auto lexer = Lexer{file.contents(), diagnostics};
+    return parse(lexer, ast, diagnostics);
+}
+
+// Like parse_file(), but loads the nodes from `cache` if they're there, and
+// stores them otherwise. Diagnostics aren't cached, so files with any aren't
+// either.
+auto parse_file(const SourceFile& file, Ast& ast, Diagnostics& diagnostics,
+                ThreadPool& pool, const AstCache& cache) -> Range<NodeId> {
+    if (const auto cached = cache.load(file.contents(), ast)) {
+        XLANG_TRACE(parser, info, file.path() << ": loaded from the cache");
+        return cached.value();
+    }
+
+    // Parsed into an Ast of its own, so that only this file is cached.
+    auto file_ast = Ast{};
+    const auto nodes = parse_file(file, file_ast, diagnostics, pool);
+    if (diagnostics.size() == 0 &&
+        !cache.store(file.contents(), file_ast, nodes)) {
+        XLANG_TRACE(parser, info, file.path() << ": could not be cached");
+    }
+    return ast.append(std::move(file_ast), nodes);
+}
+
+// The value of `Enum` that `to_string` spells `name`, if there is one.
+template <typename Enum>
+auto parse_enum(std::string_view name, auto to_string) -> std::optional<Enum> {
+    for (size_t i = 0; i < static_cast<size_t>(Enum::count); ++i) {
+        const auto value = static_cast<Enum>(i);
+        if (to_string(value) == name) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+// What the command line asks for.
+struct Options {
+    // Runs the program in this process instead of writing it out.
+    bool run = false;
+    llvmir::Output output;
+    llvmir::OptimizationOptions optimization;
+    std::vector<std::string> paths;
+};
+
+// Parses `xlang [run] [--emit=<kind>] [-o <path>] [--codegen-threads=<n>]
+// [-O<level>] [--time-passes] [file...]`. Returns std::nullopt, after saying
+// why, if the arguments are malformed.
+auto parse_options(const std::vector<std::string>& args)
+    -> std::optional<Options> {
+    auto options = Options{};
+    size_t i = 1;
+    if (i < args.size() && args[i] == "run") {
+        options.run = true;
+        ++i;
+    }
+    for (; i < args.size(); ++i) {
+        const auto& arg = args[i];
+        if (arg.starts_with("--emit=")) {
+            const auto kind = arg.substr(std::string_view{"--emit="}.size());
+            const auto output_kind = parse_enum<llvmir::OutputKind>(
+                kind, llvmir::OutputKind_to_string);
+            if (!output_kind.has_value()) {
+                std::cerr << "Unknown output kind: " << kind
+                          << " (expected ir, bitcode, assembly or object)"
+                          << '\n';
+                return std::nullopt;
+            }
+            options.output.kind = output_kind.value();
+        } else if (arg == "-o") {
+            if (++i == args.size()) {
+                std::cerr << "Expected a path after -o" << '\n';
+                return std::nullopt;
+            }
+            options.output.path = args[i];
+        } else if (arg.starts_with("--codegen-threads=")) {
+            const auto threads =
+                arg.substr(std::string_view{"--codegen-threads="}.size());
+            size_t value = 0;
+            const auto [end, error] = std::from_chars(
+                threads.data(), threads.data() + threads.size(), value);
+            if (error != std::errc{} ||
+                end != threads.data() + threads.size() || value == 0) {
+                std::cerr << "Invalid thread count: " << threads << '\n';
+                return std::nullopt;
+            }
+            options.output.threads = value;
+        } else if (arg.starts_with("-O")) {
+            const auto level = parse_enum<llvmir::OptimizationLevel>(
+                arg.substr(1), llvmir::OptimizationLevel_to_string);
+            if (!level.has_value()) {
+                std::cerr << "Unknown optimization level: " << arg
+                          << " (expected -O0, -O1, -O2, -O3 or -Os)" << '\n';
+                return std::nullopt;
+            }
+            options.optimization.level = level.value();
+        } else if (arg == "--time-passes") {
+            options.optimization.time_passes = true;
+        } else if (arg.starts_with("-") && arg != "-") {
+            std::cerr << "Unknown option: " << arg << '\n';
+            return std::nullopt;
+        } else {
+            options.paths.push_back(arg);
+        }
+    }
+    if (options.output.threads > 1 &&
+        options.output.kind != llvmir::OutputKind::object) {
+        std::cerr << "--codegen-threads only applies to --emit=object" << '\n';
+        return std::nullopt;
+    }
+    // More threads than the machine runs at once only add partitions for the
+    // linker to join.
+    const auto limit = ThreadPool::default_thread_count();
+    if (options.output.threads > limit) {
+        std::cerr << "Using " << limit << " codegen threads instead of "
+                  << options.output.threads
+                  << ", the most this machine runs at once" << '\n';
+        options.output.threads = limit;
+    }
+    if (options.paths.empty()) {
+        options.paths.emplace_back("-");
+    }
+    return options;
+}
+
 auto main(int argc, char* argv[]) -> int {
     std::vector<std::string> args(argv, argv + argc);
 
-    std::istream* input = nullptr;
-    std::ifstream file;
-
-    if (argc == 1) {
-        input = &std::cin;
-    } else if (argc == 2) {
-        file.open(args[1]);
-        if (!file.is_open()) {
-            std::cerr << "Could not open file: " << args[1] << '\n';
-            return 1;
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    if (const char* settings = std::getenv("XLANG_TRACE")) {
+        if (!trace::configure(settings)) {
+            std::cerr << "Invalid XLANG_TRACE setting: " << settings << '\n';
         }
-        input = &file;
-    } else {
-        std::cerr << "Usage: " << args[0] << " [file]" << '\n';
+    }
+
+    const auto options = parse_options(args);
+    if (!options.has_value()) {
         return 1;
     }
 
-    std::stringstream buffer;
-    buffer << input->rdbuf();
-    std::string program = buffer.str();
+    // Tokens and nodes view into the file contents, so the files stay open
+    // until the end of compilation.
+    std::vector<SourceFile> files;
+    files.reserve(options->paths.size());
+    for (const auto& path : options->paths) {
+        auto file =
+            path == "-" ? SourceFile::read_stdin() : SourceFile::open(path);
+        if (!file.has_value()) {
+            std::cerr << "Could not open file: " << path << " ("
+                      << std::strerror(errno) << ")" << '\n';
+            return 1;
+        }
+        files.push_back(std::move(file.value()));
+    }
 
     auto diagnostics = Diagnostics{};
+    auto pool = ThreadPool{};
 
-    const auto tokens = lex(program, diagnostics);
-    // for (const auto& token : tokens) {
-    //     std::cerr << token << '\n';
-    // }
-    // return 0;
+    std::optional<AstCache> cache;
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    if (const char* directory = std::getenv("XLANG_AST_CACHE")) {
+        cache.emplace(directory);
+    }
 
-    const auto ast = parse(tokens, diagnostics);
-    // for (const auto& node : ast) {
-    //     std::cerr << node << '\n';
-    // }
-    // return 0;
+    // Nodes of every file, and the top-level ones to compile.
+    auto ast = Ast{};
+    std::vector<NodeId> roots;
+    bool parsed = true;
+    for (const auto& file : files) {
+        auto file_diagnostics = Diagnostics{};
 
-    const auto module = ir::compile(ast, diagnostics);
-    std::cerr << module << '\n';
+        const auto nodes =
+            cache.has_value()
+                ? parse_file(file, ast, file_diagnostics, pool, cache.value())
+                : parse_file(file, ast, file_diagnostics, pool);
+        for (const auto node : ast[nodes]) {
+            XLANG_TRACE(parser, info,
+                        file.path() << ": " << AstNode{&ast, node});
+        }
 
-    std::cout << llvmir::print(module, diagnostics) << '\n';
+        roots.insert(roots.end(), ast[nodes].begin(), ast[nodes].end());
 
-    // const auto ir = compile(ast, diagnostics);
-    // std::cout << ir << '\n';
+        parsed = parsed && file_diagnostics.size() == 0;
+        for (const auto& diagnostic : file_diagnostics) {
+            std::cerr << file.path() << ": " << diagnostic.message << " ("
+                      << diagnostic.source << ")" << '\n';
+        }
+    }
 
-    for (const auto& diagnostic : diagnostics) {
-        std::cerr << diagnostic.message << " (" << diagnostic.source << ")"
-                  << '\n';
+    auto module = ir::compile_parallel(ast, roots, diagnostics, pool);
+    XLANG_TRACE(ir, info, module);
+
+    auto passes = ir::PassManager{};
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    if (const char* settings = std::getenv("XLANG_IR_PASSES")) {
+        if (!passes.configure(settings)) {
+            std::cerr << "Invalid XLANG_IR_PASSES setting: " << settings
+                      << '\n';
+        }
+    }
+    passes.run(module);
+
+    const auto report = [&] {
+        for (const auto& diagnostic : diagnostics) {
+            std::cerr << diagnostic.message << " (" << diagnostic.source << ")"
+                      << '\n';
+        }
+    };
+
+    // A program with errors may be missing the functions they were in, or
+    // the calls that were in those.
+    if (!parsed || diagnostics.size() > 0) {
+        report();
+        return 1;
     }
 
-    return 0;
+    if (options->run) {
+        const auto status =
+            llvmir::run(module, options->optimization, diagnostics);
+        report();
+        return status.value_or(1);
+    }
+
+    const auto emitted =
+        llvmir::emit(module, options->output, options->optimization,
+                     diagnostics);
+    report();
+
+    return emitted ? 0 : 1;
 }
@@ -0,0 +1,681 @@
+#include "ast_cache.h"
+#include "core/util/source_file.h"
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace xlang;
+
+// The encoding is a header, a table of symbol spellings and then every node
+// and list entry as fixed-size fields in host byte order:
+//
+//   magic, version, source size, source hash,
+//   node count per NodeType, entry count per list type, the range of
+//   children that holds the roots, symbol count,
+//   then each symbol as a length and its spelling,
+//   the nodes of each NodeType in order, the entries of each list type.
+//
+// Symbols are stored as indices into the table and re-interned on load, since
+// their IDs differ between processes. Text is stored as an offset and length
+// into the source. Counts come first so that every NodeId and Range can be
+// checked as it's decoded.
+
+namespace {
+
+constexpr auto MAGIC = std::array<char, 4>{'X', 'A', 'S', 'T'};
+
+// Bump whenever the encoding, or a node it encodes, changes.
+constexpr uint32_t FORMAT_VERSION = 1;
+
+constexpr auto NODE_TYPES = static_cast<size_t>(NodeType::count);
+constexpr size_t LIST_TYPES = 3;
+
+struct Header {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint64_t source_size;
+    uint64_t source_hash;
+    std::array<uint32_t, NODE_TYPES> nodes;
+    std::array<uint32_t, LIST_TYPES> lists;
+    Range<NodeId> roots;
+    uint32_t symbols;
+};
+
+// Text as an offset and length into the source.
+struct EncodedText {
+    uint32_t offset;
+    uint32_t size;
+};
+
+// Tokens are by far the most common field, so they're fixed-size and read in
+// one go. An optional token that's absent has the type ABSENT.
+struct EncodedToken {
+    uint32_t type;
+    uint32_t symbol;
+    EncodedText text;
+    int32_t line;
+    int32_t column;
+};
+
+constexpr uint32_t ABSENT = ~uint32_t{0};
+
+// No padding, so that every byte written is defined.
+static_assert(std::has_unique_object_representations_v<Header>);
+static_assert(std::has_unique_object_representations_v<EncodedToken>);
+
+class Writer {
+  public:
+    explicit Writer(std::string_view source) : source{source} {}
+
+    template <typename T> auto raw(const T& value) -> void {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto size = bytes.size();
+        bytes.resize(size + sizeof(T));
+        std::memcpy(bytes.data() + size, &value, sizeof(T));
+    }
+
+    auto symbol(Symbol symbol) -> void { raw(index(symbol)); }
+
+    auto text(std::string_view text) -> void { raw(encode(text)); }
+
+    auto token(const Token& token) -> void {
+        raw(EncodedToken{
+            .type = static_cast<uint32_t>(token.type),
+            .symbol = index(token.symbol),
+            .text = encode(token.value),
+            .line = token.source.line,
+            .column = token.source.column,
+        });
+    }
+
+    auto token(const std::optional<Token>& token) -> void {
+        if (token.has_value()) {
+            this->token(token.value());
+        } else {
+            raw(EncodedToken{.type = ABSENT,
+                             .symbol = 0,
+                             .text = {0, 0},
+                             .line = 0,
+                             .column = 0});
+        }
+    }
+
+    auto id(NodeId id) -> void {
+        raw(static_cast<uint8_t>(id.type));
+        raw(id.index);
+    }
+
+    template <typename T> auto range(Range<T> range) -> void {
+        raw(range.first);
+        raw(range.count);
+    }
+
+    auto type(const TypeIdentifier& type) -> void {
+        symbol(type.name);
+        raw(static_cast<uint32_t>(type.generic_parameters.size()));
+        for (const auto& parameter : type.generic_parameters) {
+            this->type(parameter);
+        }
+        token(type.tokens.name);
+        token(type.tokens.generic_open);
+        token(type.tokens.generic_close);
+    }
+
+    // The symbol table followed by everything written so far.
+    auto finish(Header header) -> std::string {
+        header.symbols = static_cast<uint32_t>(symbols.size());
+        auto body = std::move(bytes);
+        bytes.clear();
+        raw(header);
+        for (const auto symbol : symbols) {
+            const auto spelling = symbol.str();
+            raw(static_cast<uint32_t>(spelling.size()));
+            bytes.append(spelling);
+        }
+        bytes.append(body);
+        return std::move(bytes);
+    }
+
+  private:
+    auto index(Symbol symbol) -> uint32_t {
+        const auto [it, inserted] = symbol_indices.try_emplace(
+            symbol, static_cast<uint32_t>(symbols.size()));
+        if (inserted) {
+            symbols.push_back(symbol);
+        }
+        return it->second;
+    }
+
+    // Views outside the source, such as the spelling of a type the parser
+    // made up, are stored as empty.
+    [[nodiscard]] auto encode(std::string_view text) const -> EncodedText {
+        const auto begin = reinterpret_cast<uintptr_t>(source.data());
+        const auto offset = reinterpret_cast<uintptr_t>(text.data()) - begin;
+        if (text.empty() || offset > source.size() ||
+            text.size() > source.size() - offset) {
+            return {0, 0};
+        }
+        return {static_cast<uint32_t>(offset),
+                static_cast<uint32_t>(text.size())};
+    }
+
+    std::string_view source;
+    std::string bytes;
+    std::unordered_map<Symbol, uint32_t> symbol_indices;
+    std::vector<Symbol> symbols;
+};
+
+auto write(Writer& writer, const Identifier& node) -> void {
+    writer.symbol(node.name);
+    writer.token(node.token);
+}
+
+auto write(Writer& writer, const VariableDefinition& node) -> void {
+    writer.symbol(node.name);
+    writer.id(node.value);
+    writer.token(node.tokens.keyword);
+    writer.token(node.tokens.identifier);
+    writer.token(node.tokens.assignment);
+}
+
+auto write(Writer& writer, const FunctionDefinition& node) -> void {
+    writer.symbol(node.name);
+    writer.raw(static_cast<uint8_t>(node.external));
+    writer.raw(static_cast<uint8_t>(node.variadic));
+    writer.range(node.parameters);
+    writer.raw(static_cast<uint8_t>(node.return_type.has_value()));
+    if (node.return_type.has_value()) {
+        writer.type(node.return_type.value());
+    }
+    writer.range(node.body);
+    writer.raw(static_cast<uint8_t>(node.return_value.has_value()));
+    if (node.return_value.has_value()) {
+        writer.id(node.return_value.value());
+    }
+    writer.token(node.tokens.external);
+    writer.token(node.tokens.keyword);
+    writer.token(node.tokens.identifier);
+    writer.token(node.tokens._return);
+}
+
+auto write(Writer& writer, const FunctionCall& node) -> void {
+    writer.symbol(node.name);
+    writer.range(node.arguments);
+    writer.token(node.tokens.identifier);
+    writer.token(node.tokens.paren_open);
+    writer.token(node.tokens.paren_close);
+}
+
+auto write(Writer& writer, const MemberAccess& node) -> void {
+    writer.id(node.base);
+    writer.id(node.member);
+    writer.token(node.tokens.dot);
+}
+
+auto write(Writer& writer, const StringLiteral& node) -> void {
+    writer.text(node.value);
+    writer.token(node.token);
+}
+
+auto write(Writer& writer, const IntegerLiteral& node) -> void {
+    writer.raw(node.value);
+    writer.token(node.token);
+}
+
+auto write(Writer& writer, const StructDefinition& node) -> void {
+    writer.symbol(node.name);
+    writer.range(node.members);
+    writer.token(node.tokens.keyword);
+    writer.token(node.tokens.identifier);
+    writer.token(node.tokens.curlyOpen);
+    writer.token(node.tokens.curlyClose);
+}
+
+auto write(Writer& writer, NodeId id) -> void { writer.id(id); }
+
+auto write(Writer& writer, const FunctionDefinition::Parameter& parameter)
+    -> void {
+    writer.symbol(parameter.name);
+    writer.type(parameter.type);
+    writer.token(parameter.tokens.identifier);
+    writer.token(parameter.tokens.colon);
+}
+
+auto write(Writer& writer, const StructDefinition::Member& member) -> void {
+    writer.symbol(member.name);
+    writer.type(member.type);
+    writer.token(member.tokens.name);
+    writer.token(member.tokens.colon);
+}
+
+template <typename T>
+auto write_all(Writer& writer, std::span<const T> values) -> void {
+    for (const auto& value : values) {
+        write(writer, value);
+    }
+}
+
+// Reads what Writer wrote. Once anything is out of bounds, the reader is
+// failed and returns zeroes from then on.
+class Reader {
+  public:
+    Reader(std::string_view bytes, std::string_view source)
+        : bytes{bytes}, source{source} {}
+
+    template <typename T> auto raw() -> T {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value{};
+        if (sizeof(T) > bytes.size() - offset) {
+            failed = true;
+            offset = bytes.size();
+            return value;
+        }
+        std::memcpy(&value, bytes.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+
+    // Reads the header and symbol table, interning the symbols.
+    auto start(uint64_t hash) -> bool {
+        header = raw<Header>();
+        if (failed || header.magic != MAGIC ||
+            header.version != FORMAT_VERSION ||
+            header.source_size != source.size() ||
+            header.source_hash != hash) {
+            return false;
+        }
+        if (!fits(header.symbols, sizeof(uint32_t))) {
+            return false;
+        }
+        symbols.reserve(header.symbols);
+        for (uint32_t i = 0; i < header.symbols; ++i) {
+            const auto size = raw<uint32_t>();
+            if (failed || size > bytes.size() - offset) {
+                return false;
+            }
+            symbols.push_back(intern(bytes.substr(offset, size)));
+            offset += size;
+        }
+        return true;
+    }
+
+    // Whether `count` items of at least `size` bytes each could be left to
+    // read, so that corrupt counts can't cause huge allocations.
+    [[nodiscard]] auto fits(uint64_t count, size_t size) const -> bool {
+        return count <= (bytes.size() - offset) / size;
+    }
+
+    auto symbol() -> Symbol { return symbol(raw<uint32_t>()); }
+
+    auto text() -> std::string_view { return text(raw<EncodedText>()); }
+
+    auto token() -> Token { return token(raw<EncodedToken>()); }
+
+    auto optional_token() -> std::optional<Token> {
+        const auto encoded = raw<EncodedToken>();
+        if (encoded.type == ABSENT) {
+            return std::nullopt;
+        }
+        return token(encoded);
+    }
+
+    auto id() -> NodeId {
+        const auto type = raw<uint8_t>();
+        const auto index = raw<uint32_t>();
+        if (type >= NODE_TYPES || index >= header.nodes[type]) {
+            failed = true;
+            return NodeId{NodeType::identifier, 0};
+        }
+        return NodeId{static_cast<NodeType>(type), index};
+    }
+
+    template <typename T> auto range(size_t list) -> Range<T> {
+        const auto first = raw<uint32_t>();
+        const auto count = raw<uint32_t>();
+        if (first > header.lists[list] || count > header.lists[list] - first) {
+            failed = true;
+            return {};
+        }
+        return {first, count};
+    }
+
+    auto type() -> TypeIdentifier {
+        const auto name = symbol();
+        const auto count = raw<uint32_t>();
+        auto parameters = std::vector<TypeIdentifier>{};
+        if (!fits(count, sizeof(uint32_t))) {
+            failed = true;
+            return TypeIdentifier::_void();
+        }
+        parameters.reserve(count);
+        for (uint32_t i = 0; i < count && !failed; ++i) {
+            parameters.push_back(type());
+        }
+        return TypeIdentifier{name,
+                              std::move(parameters),
+                              {token(), optional_token(), optional_token()}};
+    }
+
+    Header header{};
+    bool failed = false;
+
+  private:
+    auto symbol(uint32_t index) -> Symbol {
+        if (index >= symbols.size()) {
+            failed = true;
+            return Symbol{};
+        }
+        return symbols[index];
+    }
+
+    auto text(EncodedText text) -> std::string_view {
+        if (text.offset > source.size() ||
+            text.size > source.size() - text.offset) {
+            failed = true;
+            return {};
+        }
+        return source.substr(text.offset, text.size);
+    }
+
+    auto token(const EncodedToken& encoded) -> Token {
+        if (encoded.type >= static_cast<uint32_t>(TokenType::count)) {
+            failed = true;
+        }
+        auto token = Token{static_cast<TokenType>(encoded.type),
+                           Source{encoded.line, encoded.column}};
+        token.symbol = symbol(encoded.symbol);
+        token.value = text(encoded.text);
+        return token;
+    }
+
+    std::string_view bytes;
+    size_t offset = 0;
+    std::string_view source;
+    std::vector<Symbol> symbols;
+};
+
+// Indices of the lists in Header::lists.
+constexpr size_t CHILDREN = 0;
+constexpr size_t PARAMETERS = 1;
+constexpr size_t MEMBERS = 2;
+
+template <typename T> auto read(Reader& reader) -> T;
+
+template <> auto read<Identifier>(Reader& reader) -> Identifier {
+    return Identifier{reader.symbol(), reader.token()};
+}
+
+template <>
+auto read<VariableDefinition>(Reader& reader) -> VariableDefinition {
+    return VariableDefinition{
+        reader.symbol(),
+        reader.id(),
+        {reader.token(), reader.token(), reader.token()}};
+}
+
+template <>
+auto read<FunctionDefinition>(Reader& reader) -> FunctionDefinition {
+    const auto name = reader.symbol();
+    const auto external = reader.raw<uint8_t>() != 0;
+    const auto variadic = reader.raw<uint8_t>() != 0;
+    const auto parameters =
+        reader.range<FunctionDefinition::Parameter>(PARAMETERS);
+    auto return_type = std::optional<TypeIdentifier>{};
+    if (reader.raw<uint8_t>() != 0) {
+        return_type = reader.type();
+    }
+    const auto body = reader.range<NodeId>(CHILDREN);
+    auto return_value = std::optional<NodeId>{};
+    if (reader.raw<uint8_t>() != 0) {
+        return_value = reader.id();
+    }
+    return FunctionDefinition{name,
+                              external,
+                              variadic,
+                              parameters,
+                              std::move(return_type),
+                              body,
+                              return_value,
+                              {reader.optional_token(), reader.token(),
+                               reader.token(), reader.optional_token()}};
+}
+
+template <> auto read<FunctionCall>(Reader& reader) -> FunctionCall {
+    return FunctionCall{reader.symbol(),
+                        reader.range<NodeId>(CHILDREN),
+                        {reader.token(), reader.token(), reader.token()}};
+}
+
+template <> auto read<MemberAccess>(Reader& reader) -> MemberAccess {
+    return MemberAccess{reader.id(), reader.id(), {reader.token()}};
+}
+
+template <> auto read<StringLiteral>(Reader& reader) -> StringLiteral {
+    return StringLiteral{reader.text(), reader.token()};
+}
+
+template <> auto read<IntegerLiteral>(Reader& reader) -> IntegerLiteral {
+    return IntegerLiteral{reader.raw<uint64_t>(), reader.token()};
+}
+
+template <> auto read<StructDefinition>(Reader& reader) -> StructDefinition {
+    return StructDefinition{reader.symbol(),
+                            reader.range<StructDefinition::Member>(MEMBERS),
+                            {reader.token(), reader.token(), reader.token(),
+                             reader.token()}};
+}
+
+template <> auto read<NodeId>(Reader& reader) -> NodeId { return reader.id(); }
+
+template <>
+auto read<FunctionDefinition::Parameter>(Reader& reader)
+    -> FunctionDefinition::Parameter {
+    return FunctionDefinition::Parameter{
+        reader.symbol(), reader.type(), {reader.token(), reader.token()}};
+}
+
+template <>
+auto read<StructDefinition::Member>(Reader& reader)
+    -> StructDefinition::Member {
+    return StructDefinition::Member{
+        reader.symbol(), reader.type(), {reader.token(), reader.token()}};
+}
+
+// The smallest encoding of any node or list entry.
+constexpr size_t MIN_ENCODED_SIZE = 5;
+
+template <typename T> auto read_nodes(Reader& reader, Ast& ast) -> bool {
+    const auto count = reader.header.nodes[static_cast<size_t>(T::TYPE)];
+    if (!reader.fits(count, MIN_ENCODED_SIZE)) {
+        return false;
+    }
+    ast.reserve<T>(count);
+    for (uint32_t i = 0; i < count && !reader.failed; ++i) {
+        ast.add(read<T>(reader));
+    }
+    return !reader.failed;
+}
+
+template <typename T>
+auto read_list(Reader& reader, size_t list, Ast& ast) -> bool {
+    const auto count = reader.header.lists[list];
+    if (!reader.fits(count, MIN_ENCODED_SIZE)) {
+        return false;
+    }
+    auto entries = std::vector<T>{};
+    entries.reserve(count);
+    for (uint32_t i = 0; i < count && !reader.failed; ++i) {
+        entries.push_back(read<T>(reader));
+    }
+    ast.add_list(std::move(entries));
+    return !reader.failed;
+}
+
+auto deserialize(std::string_view bytes, std::string_view source,
+                 uint64_t hash, Ast& ast) -> std::optional<Range<NodeId>> {
+    auto reader = Reader{bytes, source};
+    if (!reader.start(hash)) {
+        return std::nullopt;
+    }
+
+    // Decoded into an empty Ast, where the stored indices are already right,
+    // and then moved over.
+    auto decoded = Ast{};
+    const auto nodes_read =
+        read_nodes<Identifier>(reader, decoded) &&
+        read_nodes<VariableDefinition>(reader, decoded) &&
+        read_nodes<FunctionDefinition>(reader, decoded) &&
+        read_nodes<FunctionCall>(reader, decoded) &&
+        read_nodes<MemberAccess>(reader, decoded) &&
+        read_nodes<StringLiteral>(reader, decoded) &&
+        read_nodes<IntegerLiteral>(reader, decoded) &&
+        read_nodes<StructDefinition>(reader, decoded) &&
+        read_list<NodeId>(reader, CHILDREN, decoded) &&
+        read_list<FunctionDefinition::Parameter>(reader, PARAMETERS,
+                                                 decoded) &&
+        read_list<StructDefinition::Member>(reader, MEMBERS, decoded);
+    const auto roots = reader.header.roots;
+    const auto children = reader.header.lists[CHILDREN];
+    if (!nodes_read || roots.first > children ||
+        roots.count > children - roots.first) {
+        return std::nullopt;
+    }
+
+    return ast.append(std::move(decoded), roots);
+}
+
+} // namespace
+
+auto xlang::content_hash(std::string_view text) -> uint64_t {
+    // Multiply-xorshift over 32-byte blocks in four lanes, so that the
+    // multiplies don't wait on each other, then the lanes and the tail are
+    // folded in one word at a time.
+    constexpr uint64_t MULTIPLIER = 0x9E3779B97F4A7C15;
+    const auto mix = [](uint64_t hash, uint64_t word) {
+        hash = (hash ^ word) * MULTIPLIER;
+        return hash ^ (hash >> 32);
+    };
+
+    auto lanes = std::array<uint64_t, 4>{};
+    size_t i = 0;
+    for (; i + sizeof(lanes) <= text.size(); i += sizeof(lanes)) {
+        auto words = std::array<uint64_t, 4>{};
+        std::memcpy(words.data(), text.data() + i, sizeof(words));
+        for (size_t lane = 0; lane < lanes.size(); ++lane) {
+            lanes[lane] = mix(lanes[lane], words[lane]);
+        }
+    }
+
+    auto hash = static_cast<uint64_t>(text.size()) * MULTIPLIER;
+    for (const auto lane : lanes) {
+        hash = mix(hash, lane);
+    }
+    for (; i + sizeof(uint64_t) <= text.size(); i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        std::memcpy(&word, text.data() + i, sizeof(word));
+        hash = mix(hash, word);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, text.data() + i, text.size() - i);
+    hash = mix(hash, tail);
+    return mix(hash, hash >> 29);
+}
+
+auto xlang::serialize_ast(const Ast& ast, Range<NodeId> roots,
+                          std::string_view source) -> std::string {
+    auto header = Header{
+        .magic = MAGIC,
+        .version = FORMAT_VERSION,
+        .source_size = source.size(),
+        .source_hash = content_hash(source),
+        .nodes = {},
+        .lists =
+            {
+                static_cast<uint32_t>(ast.all_entries<NodeId>().size()),
+                static_cast<uint32_t>(
+                    ast.all_entries<FunctionDefinition::Parameter>().size()),
+                static_cast<uint32_t>(
+                    ast.all_entries<StructDefinition::Member>().size()),
+            },
+        .roots = roots,
+        .symbols = 0,
+    };
+
+    auto writer = Writer{source};
+    const auto nodes = [&]<typename T>(std::span<const T> values) {
+        header.nodes[static_cast<size_t>(T::TYPE)] =
+            static_cast<uint32_t>(values.size());
+        write_all(writer, values);
+    };
+    nodes(ast.all<Identifier>());
+    nodes(ast.all<VariableDefinition>());
+    nodes(ast.all<FunctionDefinition>());
+    nodes(ast.all<FunctionCall>());
+    nodes(ast.all<MemberAccess>());
+    nodes(ast.all<StringLiteral>());
+    nodes(ast.all<IntegerLiteral>());
+    nodes(ast.all<StructDefinition>());
+    write_all(writer, ast.all_entries<NodeId>());
+    write_all(writer, ast.all_entries<FunctionDefinition::Parameter>());
+    write_all(writer, ast.all_entries<StructDefinition::Member>());
+    return writer.finish(header);
+}
+
+auto xlang::deserialize_ast(std::string_view bytes, std::string_view source,
+                            Ast& ast) -> std::optional<Range<NodeId>> {
+    return deserialize(bytes, source, content_hash(source), ast);
+}
+
+auto AstCache::path(uint64_t hash) const -> std::string {
+    auto name = std::array<char, 17>{};
+    std::snprintf(name.data(), name.size(), "%016llx",
+                  static_cast<unsigned long long>(hash));
+    return directory + "/" + name.data() + ".ast";
+}
+
+auto AstCache::load(std::string_view source, Ast& ast) const
+    -> std::optional<Range<NodeId>> {
+    const auto hash = content_hash(source);
+    const auto file = SourceFile::open(path(hash));
+    if (!file.has_value()) {
+        return std::nullopt;
+    }
+    return deserialize(file.value().contents(), source, hash, ast);
+}
+
+auto AstCache::store(std::string_view source, const Ast& ast,
+                     Range<NodeId> roots) const -> bool {
+    auto error = std::error_code{};
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        return false;
+    }
+
+    // Written under a name of its own and then renamed over the final one,
+    // so readers never see a partial file.
+    const auto final_path = path(content_hash(source));
+    const auto temporary_path =
+        final_path + "." + std::to_string(::getpid()) + ".tmp";
+    {
+        const auto bytes = serialize_ast(ast, roots, source);
+        auto file = std::ofstream{temporary_path, std::ios::binary};
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!file) {
+            std::filesystem::remove(temporary_path, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary_path, final_path, error);
+    if (error) {
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
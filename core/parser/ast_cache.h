@@ -0,0 +1,55 @@
+#pragma once
+
+#include "core/parser/node.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace xlang {
+
+// A hash of source text, for telling whether it has changed since it was last
+// parsed. Not cryptographic.
+auto content_hash(std::string_view text) -> uint64_t;
+
+// Encodes every node of `ast`, which was parsed from `source`, and the list
+// of its top-level `roots`. Tokens and string literals are stored as offsets
+// into `source` rather than as text, so the encoding only decodes against the
+// same source.
+auto serialize_ast(const Ast& ast, Range<NodeId> roots,
+                   std::string_view source) -> std::string;
+
+// Adds the nodes that serialize_ast() encoded in `bytes` to `ast`, viewing
+// into `source` as if they had just been parsed from it, and returns the
+// top-level ones. Returns std::nullopt, leaving `ast` as it was, if `bytes`
+// were encoded from different source, by a different version of the format,
+// or are damaged.
+auto deserialize_ast(std::string_view bytes, std::string_view source,
+                     Ast& ast) -> std::optional<Range<NodeId>>;
+
+// Serialized ASTs in a directory, one file per source text, named after its
+// content hash. Files are replaced atomically, so concurrent compilers can
+// share a directory.
+class AstCache {
+  public:
+    explicit AstCache(std::string directory)
+        : directory{std::move(directory)} {}
+
+    // Adds the nodes cached for `source`, if any, to `ast` and returns the
+    // top-level ones.
+    auto load(std::string_view source, Ast& ast) const
+        -> std::optional<Range<NodeId>>;
+
+    // Caches every node of `ast`, parsed from `source`. Returns false if the
+    // cache file couldn't be written.
+    auto store(std::string_view source, const Ast& ast,
+               Range<NodeId> roots) const -> bool;
+
+  private:
+    [[nodiscard]] auto path(uint64_t hash) const -> std::string;
+
+    std::string directory;
+};
+
+} // namespace xlang
@@ -0,0 +1,250 @@
+#include "node.h"
+#include "core/util/trace.h"
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+using namespace xlang;
+
+namespace {
+
+// Where the nodes and lists of an appended Ast start in the one it's appended
+// to, which is what its references have to be shifted by.
+struct Offsets {
+    std::array<uint32_t, static_cast<size_t>(NodeType::count)> nodes{};
+    uint32_t children = 0;
+    uint32_t parameters = 0;
+    uint32_t members = 0;
+
+    auto operator()(NodeId& id) const -> void {
+        id.index += nodes[static_cast<size_t>(id.type)];
+    }
+    auto operator()(Range<NodeId>& range) const -> void {
+        range.first += children;
+    }
+    auto operator()(Range<FunctionDefinition::Parameter>& range) const
+        -> void {
+        range.first += parameters;
+    }
+    auto operator()(Range<StructDefinition::Member>& range) const -> void {
+        range.first += members;
+    }
+};
+
+auto rebase(NodeId& id, const Offsets& offsets) -> void { offsets(id); }
+auto rebase(FunctionDefinition::Parameter& /*parameter*/,
+            const Offsets& /*offsets*/) -> void {}
+auto rebase(StructDefinition::Member& /*member*/, const Offsets& /*offsets*/)
+    -> void {}
+auto rebase(Identifier& /*node*/, const Offsets& /*offsets*/) -> void {}
+auto rebase(StringLiteral& /*node*/, const Offsets& /*offsets*/) -> void {}
+auto rebase(IntegerLiteral& /*node*/, const Offsets& /*offsets*/) -> void {}
+
+auto rebase(VariableDefinition& node, const Offsets& offsets) -> void {
+    offsets(node.value);
+}
+
+auto rebase(FunctionDefinition& node, const Offsets& offsets) -> void {
+    offsets(node.parameters);
+    offsets(node.body);
+    if (node.return_value.has_value()) {
+        offsets(node.return_value.value());
+    }
+}
+
+auto rebase(FunctionCall& node, const Offsets& offsets) -> void {
+    offsets(node.arguments);
+}
+
+auto rebase(MemberAccess& node, const Offsets& offsets) -> void {
+    offsets(node.base);
+    offsets(node.member);
+}
+
+auto rebase(StructDefinition& node, const Offsets& offsets) -> void {
+    offsets(node.members);
+}
+
+template <typename T>
+auto append_rebased(std::vector<T>& to, std::vector<T>& from,
+                    const Offsets& offsets) -> void {
+    to.reserve(to.size() + from.size());
+    for (auto& value : from) {
+        rebase(value, offsets);
+        to.push_back(std::move(value));
+    }
+}
+
+} // namespace
+
+auto Ast::size() const -> size_t {
+    return std::apply(
+        [](const auto&... pools) { return (pools.size() + ...); }, nodes);
+}
+
+auto Ast::append(Ast&& other, std::span<NodeId> ids) -> void {
+    const auto is_empty = [](const auto&... vectors) {
+        return (vectors.empty() && ...);
+    };
+    if (std::apply(is_empty, nodes) && std::apply(is_empty, lists)) {
+        // Nothing to shift the ids past.
+        *this = std::move(other);
+        other = Ast{};
+        return;
+    }
+
+    auto offsets = Offsets{};
+    std::apply(
+        [&](const auto&... pools) {
+            ((offsets.nodes[static_cast<size_t>(
+                  std::remove_cvref_t<decltype(pools)>::value_type::TYPE)] =
+                  static_cast<uint32_t>(pools.size())),
+             ...);
+        },
+        nodes);
+    offsets.children = static_cast<uint32_t>(list_of<NodeId>().size());
+    offsets.parameters =
+        static_cast<uint32_t>(list_of<FunctionDefinition::Parameter>().size());
+    offsets.members =
+        static_cast<uint32_t>(list_of<StructDefinition::Member>().size());
+
+    std::apply(
+        [&](auto&... pools) {
+            (append_rebased(pools,
+                            std::get<std::remove_cvref_t<decltype(pools)>>(
+                                other.nodes),
+                            offsets),
+             ...);
+        },
+        nodes);
+    std::apply(
+        [&](auto&... lists) {
+            (append_rebased(lists,
+                            std::get<std::remove_cvref_t<decltype(lists)>>(
+                                other.lists),
+                            offsets),
+             ...);
+        },
+        lists);
+
+    for (auto& id : ids) {
+        offsets(id);
+    }
+    other = Ast{};
+}
+
+auto Ast::append(Ast&& other, Range<NodeId> list) -> Range<NodeId> {
+    list.first += static_cast<uint32_t>(list_of<NodeId>().size());
+    append(std::move(other), std::span<NodeId>{});
+    return list;
+}
+
+auto xlang::node_source(const Ast& ast, NodeId id) -> Source {
+    while (id.type == NodeType::member_access) {
+        id = ast.get<MemberAccess>(id).member;
+    }
+    return visit(
+        ast, id,
+        Overloaded{
+            [](const Identifier& node) { return node.token.source; },
+            [](const IntegerLiteral& node) { return node.token.source; },
+            [](const StringLiteral& node) { return node.token.source; },
+            [](const FunctionCall& node) {
+                return node.tokens.identifier.source;
+            },
+            [&](const auto& /*node*/) {
+                XLANG_TRACE(parser, info, "Unknown node type: " << id.type);
+                return Source{};
+            },
+        });
+}
+
+auto xlang::operator<<(std::ostream& os, AstNode node) -> std::ostream& {
+    const auto& ast = *node.ast;
+    // What's left to print, last first. A node prints what comes before its
+    // first child right away and queues the rest, so nesting takes no stack.
+    using Piece = std::variant<NodeId, const char*>;
+    auto pending = std::vector<Piece>{node.id};
+    auto queue = [&](std::initializer_list<Piece> pieces) {
+        pending.insert(pending.end(), std::rbegin(pieces), std::rend(pieces));
+    };
+    auto queue_list = [&](std::span<const NodeId> ids, const char* separator) {
+        for (size_t i = ids.size(); i-- > 0;) {
+            pending.emplace_back(ids[i]);
+            if (i > 0) {
+                pending.emplace_back(separator);
+            }
+        }
+    };
+
+    while (!pending.empty()) {
+        const auto piece = pending.back();
+        pending.pop_back();
+        if (const auto* const text = std::get_if<const char*>(&piece)) {
+            os << *text;
+            continue;
+        }
+
+        const auto id = std::get<NodeId>(piece);
+        os << id.type;
+        visit(
+            ast, id,
+            Overloaded{
+                [&](const Identifier& value) {
+                    os << "(" << value.name << ")";
+                },
+                [&](const StringLiteral& value) {
+                    os << "(" << value.value << ")";
+                },
+                [&](const VariableDefinition& value) {
+                    os << "(" << value.name << "=";
+                    queue({value.value, ")"});
+                },
+                [&](const StructDefinition& value) {
+                    os << "(" << value.name;
+                    if (!value.members.empty()) {
+                        os << ",";
+                    }
+                    for (const auto& member : ast[value.members]) {
+                        os << member.name << ":" << member.type;
+                    }
+                    os << ")";
+                },
+                [&](const FunctionDefinition& value) {
+                    os << "(" << value.name;
+                    if (value.external) {
+                        os << ",external";
+                    }
+                    if (!value.parameters.empty()) {
+                        os << ",";
+                    }
+                    auto first = true;
+                    for (const auto& parameter : ast[value.parameters]) {
+                        if (!first) {
+                            os << ",";
+                        }
+                        first = false;
+                        os << parameter.name << ":" << parameter.type;
+                    }
+                    if (!value.body.empty()) {
+                        os << ",";
+                    }
+                    queue({")"});
+                    queue_list(ast[value.body], ",");
+                },
+                [&](const FunctionCall& value) {
+                    os << "(" << value.name << ",";
+                    queue({")"});
+                    queue_list(ast[value.arguments], "");
+                },
+                [&](const MemberAccess& value) {
+                    os << "(";
+                    queue({value.base, " > ", value.member, ")"});
+                },
+                [](const IntegerLiteral& /*value*/) {},
+            });
+    }
+    return os;
+}
@@ -1,14 +1,21 @@
 #pragma once
 
 #include "core/util/enum.h"
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
 #include <iostream>
-#include <memory>
 #include <optional>
+#include <span>
 #include <string>
-#include <variant>
+#include <string_view>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "core/lexer/token.h"
+#include "core/util/symbol.h"
 
 namespace xlang {
 
@@ -16,37 +23,66 @@ ENUM_CLASS(NodeType, identifier, variable_definition, function_definition,
            function_call, member_access, string_literal, integer_literal,
            struct_definition);
 
-struct Node;
+// Refers to a node of an Ast: the `index`th node of type `type`.
+struct NodeId {
+    NodeType type;
+    uint32_t index;
+    auto operator==(const NodeId& other) const -> bool = default;
+};
+
+// Consecutive entries of one of the Ast's lists of children, parameters or
+// members.
+template <typename T> struct Range {
+    uint32_t first = 0;
+    uint32_t count = 0;
+
+    [[nodiscard]] auto size() const -> size_t { return count; }
+    [[nodiscard]] auto empty() const -> bool { return count == 0; }
+    auto operator==(const Range& other) const -> bool = default;
+};
+
+// Names are interned symbols. String literal values view into the lexed source
+// buffer, like the tokens they came from. Nodes refer to their children by
+// NodeId and Range, which are only meaningful within their Ast.
 
 struct TypeIdentifier {
-    static auto _void() -> TypeIdentifier { return anonymous_type("Void"); };
+    static auto _void() -> TypeIdentifier {
+        return anonymous_type(symbols::VOID);
+    };
 
-    static auto string() -> TypeIdentifier { return anonymous_type("String"); };
+    static auto string() -> TypeIdentifier {
+        return anonymous_type(symbols::STRING);
+    };
 
-    static auto uint8() -> TypeIdentifier { return anonymous_type("UInt8"); };
+    static auto uint8() -> TypeIdentifier {
+        return anonymous_type(symbols::UINT8);
+    };
 
-    static auto int32() -> TypeIdentifier { return anonymous_type("Int32"); };
+    static auto int32() -> TypeIdentifier {
+        return anonymous_type(symbols::INT32);
+    };
 
     static auto pointer_to(const TypeIdentifier& type) -> TypeIdentifier {
-        auto pointer = anonymous_type("Pointer");
+        auto pointer = anonymous_type(symbols::POINTER);
         pointer.generic_parameters.push_back(type);
         return pointer;
     };
 
     // TODO: make this less gross (move source to parent type?)
-    static auto anonymous_type(const std::string& name) -> TypeIdentifier {
-        return TypeIdentifier{name,
-                              {},
-                              {
-                                  Token{TokenType::identifier, name, Source{}},
-                              }};
+    static auto anonymous_type(Symbol name) -> TypeIdentifier {
+        return TypeIdentifier{
+            name,
+            {},
+            {
+                Token{TokenType::identifier, name.str(), Source{}},
+            }};
     };
 
-    std::string name;
+    Symbol name;
     std::vector<TypeIdentifier> generic_parameters;
 
     [[nodiscard]] auto full_name() const -> std::string {
-        std::string result = name;
+        std::string result{name.str()};
         if (!generic_parameters.empty()) {
             result += "<";
             bool first = true;
@@ -94,12 +130,13 @@ inline auto operator<<(std::ostream& os, const TypeIdentifier& value)
     }
     return os;
 }
-
 struct StructDefinition {
-    std::string name;
+    static constexpr auto TYPE = NodeType::struct_definition;
+
+    Symbol name;
 
     struct Member {
-        std::string name;
+        Symbol name;
         TypeIdentifier type;
 
         struct Tokens {
@@ -113,7 +150,7 @@ struct StructDefinition {
         auto operator==(const Member& other) const -> bool = default;
     };
 
-    std::vector<Member> members;
+    Range<Member> members;
 
     struct Tokens {
         Token keyword;
@@ -128,8 +165,10 @@ struct StructDefinition {
 };
 
 struct FunctionCall {
-    std::string name;
-    std::vector<Node> arguments;
+    static constexpr auto TYPE = NodeType::function_call;
+
+    Symbol name;
+    Range<NodeId> arguments;
 
     struct Tokens {
         Token identifier;
@@ -143,8 +182,10 @@ struct FunctionCall {
 };
 
 struct MemberAccess {
-    std::shared_ptr<Node> base;
-    std::shared_ptr<Node> member;
+    static constexpr auto TYPE = NodeType::member_access;
+
+    NodeId base;
+    NodeId member;
 
     struct Tokens {
         Token dot;
@@ -156,12 +197,14 @@ struct MemberAccess {
 };
 
 struct FunctionDefinition {
-    std::string name;
+    static constexpr auto TYPE = NodeType::function_definition;
+
+    Symbol name;
     bool external;
     bool variadic;
 
     struct Parameter {
-        std::string name;
+        Symbol name;
         TypeIdentifier type;
 
         struct Tokens {
@@ -173,10 +216,10 @@ struct FunctionDefinition {
 
         auto operator==(const Parameter& other) const -> bool = default;
     };
-    std::vector<Parameter> parameters;
+    Range<Parameter> parameters;
     std::optional<TypeIdentifier> return_type;
-    std::vector<Node> body;
-    std::shared_ptr<Node> return_value;
+    Range<NodeId> body;
+    std::optional<NodeId> return_value;
 
     struct Tokens {
         std::optional<Token> external;
@@ -191,8 +234,10 @@ struct FunctionDefinition {
 };
 
 struct VariableDefinition {
-    std::string name;
-    std::shared_ptr<Node> value;
+    static constexpr auto TYPE = NodeType::variable_definition;
+
+    Symbol name;
+    NodeId value;
 
     struct Tokens {
         Token keyword;
@@ -206,161 +251,183 @@ struct VariableDefinition {
 };
 
 struct Identifier {
-    std::string name;
+    static constexpr auto TYPE = NodeType::identifier;
+
+    Symbol name;
     Token token;
     auto operator==(const Identifier& other) const -> bool = default;
 };
 
 struct StringLiteral {
-    std::string value;
+    static constexpr auto TYPE = NodeType::string_literal;
+
+    std::string_view value;
     Token token;
     auto operator==(const StringLiteral& other) const -> bool = default;
 };
 
 struct IntegerLiteral {
+    static constexpr auto TYPE = NodeType::integer_literal;
+
     uint64_t value;
     Token token;
     auto operator==(const IntegerLiteral& other) const -> bool = default;
 };
 
-using NodeValue = std::variant<StringLiteral, IntegerLiteral, Identifier,
-                               FunctionDefinition, FunctionCall, MemberAccess,
-                               VariableDefinition, StructDefinition>;
-
-struct Node {
-    NodeType type;
-    NodeValue value;
-
-    Node(NodeType type, NodeValue value)
-        : type{type}, value{std::move(value)} {}
-    Node(FunctionCall value) : Node(NodeType::function_call, value) {}
-    Node(MemberAccess value) : Node(NodeType::member_access, value) {}
-    Node(FunctionDefinition value)
-        : Node(NodeType::function_definition, value) {}
-    Node(VariableDefinition value)
-        : Node(NodeType::variable_definition, value) {}
-    Node(StructDefinition value) : Node(NodeType::struct_definition, value) {}
-    Node(Identifier identifier) : Node(NodeType::identifier, identifier) {}
-    Node(StringLiteral stringLiteral)
-        : Node(NodeType::string_literal, stringLiteral) {}
-    Node(IntegerLiteral integerLiteral)
-        : Node(NodeType::integer_literal, integerLiteral) {}
-};
+// The nodes of one or more parses, stored by type: each type has a vector of
+// its nodes, in the order they were created (children before their parents),
+// and lists of children, parameters and members are runs of shared vectors.
+// Visiting every node of a type is a linear scan, and the whole tree is a
+// handful of allocations.
+class Ast {
+  public:
+    template <typename T> auto add(T node) -> NodeId {
+        auto& pool = nodes_of<T>();
+        pool.push_back(std::move(node));
+        return {T::TYPE, static_cast<uint32_t>(pool.size() - 1)};
+    }
 
-inline auto node_source(Node node) -> Source {
-    switch (node.type) {
-    case NodeType::identifier:
-        return std::get<Identifier>(node.value).token.source;
-    case NodeType::integer_literal:
-        return std::get<IntegerLiteral>(node.value).token.source;
-    case NodeType::string_literal:
-        return std::get<StringLiteral>(node.value).token.source;
-    case NodeType::member_access:
-        return node_source(*std::get<MemberAccess>(node.value).member);
-    case NodeType::function_call:
-        return std::get<FunctionCall>(node.value).tokens.identifier.source;
-    default:
-        std::cerr << "Unknown node type: " << node.type << '\n';
-        return Source{};
+    // Makes room for `count` more nodes of type T.
+    template <typename T> auto reserve(size_t count) -> void {
+        auto& pool = nodes_of<T>();
+        pool.reserve(pool.size() + count);
     }
-}
 
-inline auto operator<<(std::ostream& os, Node node) -> std::ostream& {
-    os << node.type;
-    switch (node.type) {
-    case NodeType::identifier:
-        os << "(" << std::get<Identifier>(node.value).name << ")";
-        break;
-    case NodeType::string_literal: {
-        os << "(" << std::get<StringLiteral>(node.value).value << ")";
-    } break;
-    case NodeType::variable_definition: {
-        auto variable_definition = std::get<VariableDefinition>(node.value);
-        os << "(" << variable_definition.name << "="
-           << *variable_definition.value << ")";
-    } break;
-    case NodeType::struct_definition: {
-        auto value = std::get<StructDefinition>(node.value);
-        os << "(" << value.name;
-        if (!value.members.empty()) {
-            os << ",";
-        }
-        for (const auto& member : value.members) {
-            os << member.name << ":" << member.type;
+    // Appends a list of children, parameters or members.
+    template <typename T> auto add_list(std::vector<T> values) -> Range<T> {
+        auto& list = list_of<T>();
+        const auto begin = static_cast<uint32_t>(list.size());
+        if (list.empty()) {
+            list = std::move(values);
+            return {0, static_cast<uint32_t>(list.size())};
         }
-        os << ")";
-    } break;
-    case NodeType::function_definition: {
-        auto value = std::get<FunctionDefinition>(node.value);
-        os << "(" << value.name;
-        if (value.external) {
-            os << ",external";
-        }
-        if (!value.parameters.empty()) {
-            os << ",";
-        }
-        auto first = true;
-        for (const auto& parameter : value.parameters) {
-            if (!first) {
-                os << ",";
-            }
-            first = false;
-            os << parameter.name << ":" << parameter.type;
-        }
-        if (!value.body.empty()) {
-            os << ",";
-        }
-        first = true;
-        for (const auto& body : value.body) {
-            if (!first) {
-                os << ",";
-            }
-            first = false;
-            os << body;
-        }
-        os << ")";
-    } break;
-    case NodeType::function_call: {
-        auto function_call = std::get<FunctionCall>(node.value);
-        os << "(" << function_call.name << ",";
-        for (const auto& argument : function_call.arguments) {
-            os << argument;
-        }
-        os << ")";
-    } break;
-    case NodeType::member_access: {
-        auto value = std::get<MemberAccess>(node.value);
-        os << "(" << *value.base << " > " << *value.member << ")";
-    } break;
-    default:
-        break;
+        list.insert(list.end(), std::make_move_iterator(values.begin()),
+                    std::make_move_iterator(values.end()));
+        return {begin, static_cast<uint32_t>(values.size())};
+    }
+
+    // The node `id` refers to, which must be a T. Unlike std::get, this
+    // doesn't check the type outside of debug builds.
+    template <typename T> [[nodiscard]] auto get(NodeId id) const -> const T& {
+        assert(id.type == T::TYPE);
+        return nodes_of<T>()[id.index];
+    }
+
+    template <typename T>
+    [[nodiscard]] auto operator[](Range<T> range) const -> std::span<const T> {
+        return std::span<const T>{list_of<T>()}.subspan(range.first,
+                                                        range.count);
+    }
+
+    // Every node of type T, in order of creation.
+    template <typename T> [[nodiscard]] auto all() const -> std::span<const T> {
+        return nodes_of<T>();
+    }
+
+    // Every entry of every list of T, in order of creation.
+    template <typename T>
+    [[nodiscard]] auto all_entries() const -> std::span<const T> {
+        return list_of<T>();
+    }
+
+    [[nodiscard]] auto size() const -> size_t;
+
+    // Moves the nodes of `other` to the end of this Ast. `ids`, which refer to
+    // nodes of `other`, are updated to refer to them here.
+    auto append(Ast&& other, std::span<NodeId> ids) -> void;
+    // Like the above, but returns where `list`, one of the lists of children
+    // of `other`, ends up here.
+    auto append(Ast&& other, Range<NodeId> list) -> Range<NodeId>;
+
+    auto operator==(const Ast& other) const -> bool = default;
+
+  private:
+    template <typename T> auto nodes_of() -> std::vector<T>& {
+        return std::get<std::vector<T>>(nodes);
+    }
+    template <typename T>
+    [[nodiscard]] auto nodes_of() const -> const std::vector<T>& {
+        return std::get<std::vector<T>>(nodes);
     }
-    return os;
-}
 
-inline auto operator==(const Node& lhs, const Node& rhs) -> bool {
-    if (lhs.type != rhs.type) {
-        return false;
+    template <typename T> auto list_of() -> std::vector<T>& {
+        return std::get<std::vector<T>>(lists);
+    }
+    template <typename T>
+    [[nodiscard]] auto list_of() const -> const std::vector<T>& {
+        return std::get<std::vector<T>>(lists);
     }
 
-    switch (lhs.type) {
+    std::tuple<std::vector<Identifier>, std::vector<VariableDefinition>,
+               std::vector<FunctionDefinition>, std::vector<FunctionCall>,
+               std::vector<MemberAccess>, std::vector<StringLiteral>,
+               std::vector<IntegerLiteral>, std::vector<StructDefinition>>
+        nodes;
+    std::tuple<std::vector<NodeId>, std::vector<FunctionDefinition::Parameter>,
+               std::vector<StructDefinition::Member>>
+        lists;
+};
+
+// Calls `visitor` with the node `id` refers to, as its own type, and returns
+// what it returns.
+template <typename Visitor>
+auto visit(const Ast& ast, NodeId id, Visitor&& visitor) -> decltype(auto) {
+    switch (id.type) {
     case NodeType::identifier:
-        return std::get<Identifier>(lhs.value) ==
-               std::get<Identifier>(rhs.value);
-    case NodeType::string_literal:
-        return std::get<StringLiteral>(lhs.value) ==
-               std::get<StringLiteral>(rhs.value);
+        return visitor(ast.get<Identifier>(id));
+    case NodeType::variable_definition:
+        return visitor(ast.get<VariableDefinition>(id));
     case NodeType::function_definition:
-        return std::get<FunctionDefinition>(lhs.value) ==
-               std::get<FunctionDefinition>(rhs.value);
+        return visitor(ast.get<FunctionDefinition>(id));
     case NodeType::function_call:
-        return std::get<FunctionCall>(lhs.value) ==
-               std::get<FunctionCall>(rhs.value);
-    default:
-        return false;
+        return visitor(ast.get<FunctionCall>(id));
+    case NodeType::member_access:
+        return visitor(ast.get<MemberAccess>(id));
+    case NodeType::string_literal:
+        return visitor(ast.get<StringLiteral>(id));
+    case NodeType::integer_literal:
+        return visitor(ast.get<IntegerLiteral>(id));
+    case NodeType::struct_definition:
+        return visitor(ast.get<StructDefinition>(id));
+    case NodeType::count:
+        break;
     }
+    assert(false && "invalid node type");
+    std::unreachable();
+}
 
-    return false;
+// Calls `visitor(node, id)` for every node of `ast`, one type after another.
+template <typename Visitor>
+auto visit_all(const Ast& ast, Visitor&& visitor) -> void {
+    const auto each = [&]<typename T>(std::span<const T> nodes) {
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            visitor(nodes[i], NodeId{T::TYPE, i});
+        }
+    };
+    each(ast.all<Identifier>());
+    each(ast.all<VariableDefinition>());
+    each(ast.all<FunctionDefinition>());
+    each(ast.all<FunctionCall>());
+    each(ast.all<MemberAccess>());
+    each(ast.all<StringLiteral>());
+    each(ast.all<IntegerLiteral>());
+    each(ast.all<StructDefinition>());
 }
 
+// Builds a visitor out of one lambda per node type, e.g.
+//     visit(ast, id, Overloaded{[](const Identifier&) {...}, ...});
+template <typename... Visitors> struct Overloaded : Visitors... {
+    using Visitors::operator()...;
+};
+
+auto node_source(const Ast& ast, NodeId id) -> Source;
+
+// A node and the Ast it's in, for printing it with its children.
+struct AstNode {
+    const Ast* ast;
+    NodeId id;
+};
+
+auto operator<<(std::ostream& os, AstNode node) -> std::ostream&;
+
 } // namespace xlang
@@ -1,116 +1,98 @@
 #include "parser.h"
 #include "core/lexer/token.h"
 #include "core/parser/node.h"
-#include <memory>
+#include "core/util/trace.h"
+#include <charconv>
+#include <concepts>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
 
 using namespace xlang;
 
-auto parse_expression(Buffer<std::vector<Token>>& tokens,
-                      Diagnostics& diagnostics) -> std::optional<Node>;
-
-auto require_next_token(TokenType type, const std::string& error,
-                        const Token& previousToken,
-                        Buffer<std::vector<Token>>& tokens,
-                        Diagnostics& diagnostics) -> std::optional<Token> {
-    auto token = tokens.safe_peek();
-    if (!token.has_value() || token.value().type != type) {
-        const auto description = token.has_value()
-                                     ? TokenType_to_string(token.value().type)
-                                     : "nothing";
-
-        diagnostics.push_error(error + ", got " + description,
-                               token.has_value() ? token.value().source
-                                                 : previousToken.source);
-
-        return std::nullopt;
-    }
-
-    return tokens.pop();
-}
-
-auto peek_token_type(Buffer<std::vector<Token>>& tokens, TokenType type)
-    -> bool {
-    if (tokens.empty()) {
-        return false;
-    }
-
-    return tokens.peek().type == type;
-}
-
-auto parse_function_call(const Token& identifier,
-                         Buffer<std::vector<Token>>& tokens,
-                         Diagnostics& diagnostics) -> std::optional<Node> {
-    auto name = std::get<std::string>(identifier.value);
-
-    auto paren_open =
-        require_next_token(TokenType::paren_open, "Expected open paren",
-                           identifier, tokens, diagnostics);
-    if (!paren_open.has_value()) {
-        return std::nullopt;
-    }
-
-    std::vector<Node> arguments;
-    std::optional<Token> paren_close = std::nullopt;
-    while (true) {
-        auto token = tokens.safe_peek();
+// The parser reads from any cursor with Buffer's interface. Cursors that can
+// report the next kinds without materializing whole tokens also provide
+// peek_type(), which the lookahead below prefers.
+template <typename T>
+concept TokenInput = requires(T tokens, const T& view, int skip) {
+    { view.safe_peek(skip) } -> std::same_as<std::optional<Token>>;
+    { tokens.safe_pop() } -> std::same_as<std::optional<Token>>;
+    { tokens.pop() } -> std::same_as<Token>;
+    { view.empty() } -> std::same_as<bool>;
+};
+
+template <TokenInput Tokens>
+auto peek_type(const Tokens& tokens, int skip = 0) -> std::optional<TokenType> {
+    if constexpr (requires { tokens.peek_type(skip); }) {
+        return tokens.peek_type(skip);
+    } else {
+        const auto token = tokens.safe_peek(skip);
         if (!token.has_value()) {
-            diagnostics.push_error("Expected function arguments",
-                                   paren_open.value().source);
             return std::nullopt;
         }
+        return token.value().type;
+    }
+}
 
-        if (token.value().type == TokenType::comma) {
-            paren_close = tokens.safe_pop();
-        }
+template <TokenInput Tokens>
+auto parse_expression(Tokens& tokens, Ast& ast,
+                      Diagnostics& diagnostics) -> std::optional<NodeId>;
 
-        if (token.value().type == TokenType::paren_close) {
-            paren_close = tokens.safe_pop();
-            break;
-        }
+template <TokenInput Tokens>
+auto require_next_token(TokenType type, std::string_view error,
+                        const Token& previousToken, Tokens& tokens,
+                        Diagnostics& diagnostics) -> std::optional<Token> {
+    const auto next = peek_type(tokens);
+    if (next != type) {
+        const auto description =
+            next.has_value() ? TokenType_to_string(next.value()) : "nothing";
 
-        auto argument = parse_expression(tokens, diagnostics);
-        if (!argument.has_value()) {
-            diagnostics.push_error("Failed to parse function arguments",
-                                   paren_open.value().source);
-            break;
-        }
-        arguments.push_back(argument.value());
-    }
+        diagnostics.push_error(std::string{error} + ", got " + description,
+                               next.has_value() ? tokens.peek().source
+                                                : previousToken.source);
 
-    if (!paren_close.has_value()) {
         return std::nullopt;
     }
 
-    return Node{
-        FunctionCall{name,
-                     arguments,
-                     {identifier, paren_open.value(), paren_close.value()}}};
+    return tokens.pop();
 }
 
-auto parse_identifier_or_function_call(const Token& previousToken,
-                                       Buffer<std::vector<Token>>& tokens,
-                                       Diagnostics& diagnostics)
-    -> std::optional<Node> {
-
-    auto identifier =
-        require_next_token(TokenType::identifier, "Expected identifier",
-                           previousToken, tokens, diagnostics);
-    if (!identifier.has_value()) {
-        return std::nullopt;
-    }
-
-    auto name = std::get<std::string>(identifier.value().value);
+template <TokenInput Tokens>
+auto peek_token_type(const Tokens& tokens, TokenType type) -> bool {
+    return peek_type(tokens) == type;
+}
 
-    auto next = tokens.safe_peek();
-    if (next.has_value() && next.value().type == TokenType::paren_open) {
-        return parse_function_call(identifier.value(), tokens, diagnostics);
+namespace {
+
+// A call whose arguments are still being parsed.
+struct PendingCall {
+    Token identifier;
+    Token paren_open;
+    // Set by the closing paren, or by the last comma if the call fails to
+    // parse before reaching it.
+    std::optional<Token> paren_close;
+    std::vector<NodeId> arguments;
+    // The base and dot of `base.call(...)`, if the call is a member.
+    std::optional<NodeId> base;
+    std::optional<Token> dot;
+};
+
+} // namespace
+
+auto finish_call(PendingCall call, Ast& ast) -> NodeId {
+    const auto id = ast.add(FunctionCall{
+        call.identifier.symbol,
+        ast.add_list(std::move(call.arguments)),
+        {call.identifier, call.paren_open, call.paren_close.value()}});
+    if (!call.base.has_value()) {
+        return id;
     }
-
-    return Node{Identifier{name, {identifier.value()}}};
+    return ast.add(MemberAccess{call.base.value(), id, {call.dot.value()}});
 }
 
-auto parse_type_identifier(const Token& previousToken,
-                           Buffer<std::vector<Token>>& tokens,
+template <TokenInput Tokens>
+auto parse_type_identifier(const Token& previousToken, Tokens& tokens,
                            Diagnostics& diagnostics)
     -> std::optional<TypeIdentifier> {
     auto name = require_next_token(TokenType::identifier, "Expected type name",
@@ -122,18 +104,18 @@ auto parse_type_identifier(const Token& previousToken,
 
     auto generic_parameters = std::vector<TypeIdentifier>{};
 
-    auto maybe_generic_start = tokens.safe_peek();
+    std::optional<Token> maybe_generic_start = std::nullopt;
     std::optional<Token> maybe_generic_end = std::nullopt;
-    if (maybe_generic_start.has_value() &&
-        maybe_generic_start.value().type == TokenType::angle_open) {
+    if (peek_token_type(tokens, TokenType::angle_open)) {
+        maybe_generic_start = tokens.pop();
 
-        auto generic_parameter =
-            parse_type_identifier(tokens.pop(), tokens, diagnostics);
+        auto generic_parameter = parse_type_identifier(
+            maybe_generic_start.value(), tokens, diagnostics);
         if (!generic_parameter.has_value()) {
             return std::nullopt;
         }
 
-        generic_parameters.push_back(generic_parameter.value());
+        generic_parameters.push_back(std::move(generic_parameter.value()));
 
         // TODO: support more than one generic parameter
 
@@ -146,13 +128,13 @@ auto parse_type_identifier(const Token& previousToken,
     }
 
     return std::make_optional(
-        TypeIdentifier{std::get<std::string>(name.value().value),
-                       generic_parameters,
+        TypeIdentifier{name.value().symbol,
+                       std::move(generic_parameters),
                        {name.value(), maybe_generic_start, maybe_generic_end}});
 }
 
-auto parse_function_definition_parameter(const Token& keyword,
-                                         Buffer<std::vector<Token>>& tokens,
+template <TokenInput Tokens>
+auto parse_function_definition_parameter(const Token& keyword, Tokens& tokens,
                                          Diagnostics& diagnostics,
                                          const Token& previous)
     -> std::optional<FunctionDefinition::Parameter> {
@@ -176,13 +158,13 @@ auto parse_function_definition_parameter(const Token& keyword,
     }
 
     return std::make_optional(FunctionDefinition::Parameter{
-        std::get<std::string>(identifier.value().value),
-        type.value(),
+        identifier.value().symbol,
+        std::move(type.value()),
         {identifier.value(), colon.value()}});
 }
 
-auto parse_struct_member(const Token& keyword,
-                         Buffer<std::vector<Token>>& tokens,
+template <TokenInput Tokens>
+auto parse_struct_member(const Token& keyword, Tokens& tokens,
                          Diagnostics& diagnostics)
     -> std::optional<StructDefinition::Member> {
     auto identifier =
@@ -204,14 +186,16 @@ auto parse_struct_member(const Token& keyword,
     }
 
     return std::make_optional(StructDefinition::Member{
-        std::get<std::string>(identifier.value().value),
-        type.value(),
+        identifier.value().symbol,
+        std::move(type.value()),
         {identifier.value(), colon.value()},
     });
 }
 
-auto parse_struct_definition(Token keyword, Buffer<std::vector<Token>>& tokens,
-                             Diagnostics& diagnostics) -> std::optional<Node> {
+template <TokenInput Tokens>
+auto parse_struct_definition(Token keyword, Tokens& tokens, Ast& ast,
+                             Diagnostics& diagnostics)
+    -> std::optional<NodeId> {
     auto identifier =
         require_next_token(TokenType::identifier, "Expected struct name",
                            keyword, tokens, diagnostics);
@@ -219,7 +203,7 @@ auto parse_struct_definition(Token keyword, Buffer<std::vector<Token>>& tokens,
         return std::nullopt;
     }
 
-    auto name = std::get<std::string>(identifier.value().value);
+    auto name = identifier.value().symbol;
 
     auto curly_open = require_next_token(
         TokenType::curly_open,
@@ -233,40 +217,39 @@ auto parse_struct_definition(Token keyword, Buffer<std::vector<Token>>& tokens,
 
     std::optional<Token> curly_close = std::nullopt;
     while (true) {
-        auto token = tokens.safe_peek();
-        if (!token.has_value()) {
+        const auto next = peek_type(tokens);
+        if (!next.has_value()) {
             diagnostics.push_error("Expected struct members",
                                    identifier.value().source);
             return std::nullopt;
         }
 
-        if (token.value().type == TokenType::curly_close) {
+        if (next == TokenType::curly_close) {
             curly_close = tokens.safe_pop();
             break;
         }
 
-        auto member = parse_struct_member(token.value(), tokens, diagnostics);
+        auto member = parse_struct_member(tokens.peek(), tokens, diagnostics);
         if (!member.has_value()) {
             continue;
         }
-        members.push_back(member.value());
+        members.push_back(std::move(member.value()));
     }
 
     if (!curly_close.has_value()) {
         return std::nullopt;
     }
 
-    return std::make_optional(
-        Node{StructDefinition{name,
-                              members,
-                              {keyword, identifier.value(), curly_open.value(),
-                               curly_close.value()}}});
+    return ast.add(StructDefinition{name,
+                                    ast.add_list(std::move(members)),
+                                    {keyword, identifier.value(),
+                                     curly_open.value(), curly_close.value()}});
 }
 
-auto parse_function_definition(Token keyword,
-                               Buffer<std::vector<Token>>& tokens,
+template <TokenInput Tokens>
+auto parse_function_definition(Token keyword, Tokens& tokens, Ast& ast,
                                Diagnostics& diagnostics)
-    -> std::optional<Node> {
+    -> std::optional<NodeId> {
     std::optional<Token> external_keyword;
     if (keyword.type == TokenType::external) {
         external_keyword = keyword;
@@ -286,7 +269,7 @@ auto parse_function_definition(Token keyword,
         return std::nullopt;
     }
 
-    auto name = std::get<std::string>(identifier.value().value);
+    auto name = identifier.value().symbol;
 
     auto paren_open =
         require_next_token(TokenType::paren_open, "Expected open paren",
@@ -295,24 +278,24 @@ auto parse_function_definition(Token keyword,
 
     bool variadic = false;
     while (true) {
-        auto token = tokens.safe_peek();
-        if (!token.has_value()) {
+        const auto next = peek_type(tokens);
+        if (!next.has_value()) {
             diagnostics.push_error("Expected function arguments",
                                    identifier.value().source);
             return std::nullopt;
         }
 
-        if (token.value().type == TokenType::paren_close) {
+        if (next == TokenType::paren_close) {
             tokens.pop();
             break;
         }
 
-        if (token.value().type == TokenType::comma) {
+        if (next == TokenType::comma) {
             tokens.pop();
             continue;
         }
 
-        if (token.value().type == TokenType::variadic) {
+        if (next == TokenType::variadic) {
             tokens.pop();
             variadic = true;
             continue;
@@ -324,7 +307,7 @@ auto parse_function_definition(Token keyword,
             continue;
         }
 
-        parameters.push_back(parameter.value());
+        parameters.push_back(std::move(parameter.value()));
     }
 
     std::optional<TypeIdentifier> return_type = std::nullopt;
@@ -339,8 +322,8 @@ auto parse_function_definition(Token keyword,
         }
     }
 
-    auto body = std::vector<Node>{};
-    std::shared_ptr<Node> return_value = nullptr;
+    auto body = std::vector<NodeId>{};
+    std::optional<NodeId> return_value = std::nullopt;
     std::optional<Token> return_token = std::nullopt;
     if (!external_keyword.has_value()) {
         require_next_token(TokenType::curly_open,
@@ -348,35 +331,34 @@ auto parse_function_definition(Token keyword,
                            identifier.value(), tokens, diagnostics);
 
         while (true) {
-            auto token = tokens.safe_peek();
-            if (!token.has_value()) {
+            const auto next = peek_type(tokens);
+            if (!next.has_value()) {
                 diagnostics.push_error("Expected function body",
                                        identifier.value().source);
                 return std::nullopt;
             }
 
-            if (token.value().type == TokenType::curly_close) {
+            if (next == TokenType::curly_close) {
                 tokens.pop();
                 break;
             }
 
-            if (token.value().type == TokenType::_return) {
+            if (next == TokenType::_return) {
                 return_token = tokens.safe_pop();
-                const auto maybe_return_value =
-                    parse_expression(tokens, diagnostics);
+                auto maybe_return_value =
+                    parse_expression(tokens, ast, diagnostics);
                 if (!maybe_return_value.has_value()) {
                     diagnostics.push_error("Expected return value",
-                                           token.value().source);
+                                           return_token.value().source);
                     tokens.safe_pop();
                     continue;
                 }
 
-                return_value =
-                    std::make_shared<Node>(maybe_return_value.value());
+                return_value = maybe_return_value;
                 continue;
             }
 
-            auto expr = parse_expression(tokens, diagnostics);
+            auto expr = parse_expression(tokens, ast, diagnostics);
             if (!expr.has_value()) {
                 tokens.safe_pop();
                 continue;
@@ -385,20 +367,21 @@ auto parse_function_definition(Token keyword,
         }
     }
 
-    return std::make_optional(Node{FunctionDefinition{
+    return ast.add(FunctionDefinition{
         name,
         external_keyword.has_value(),
         variadic,
-        parameters,
-        return_type,
-        body,
+        ast.add_list(std::move(parameters)),
+        std::move(return_type),
+        ast.add_list(std::move(body)),
         return_value,
-        {external_keyword, keyword, identifier.value(), return_token}}});
+        {external_keyword, keyword, identifier.value(), return_token}});
 }
 
-auto parse_variable_definition(Buffer<std::vector<Token>>& tokens,
+template <TokenInput Tokens>
+auto parse_variable_definition(Tokens& tokens, Ast& ast,
                                Diagnostics& diagnostics, Token varToken)
-    -> std::optional<Node> {
+    -> std::optional<NodeId> {
     auto identifier =
         require_next_token(TokenType::identifier, "Expected variable name",
                            varToken, tokens, diagnostics);
@@ -406,7 +389,7 @@ auto parse_variable_definition(Buffer<std::vector<Token>>& tokens,
         return std::nullopt;
     }
 
-    std::string name = std::get<std::string>(identifier.value().value);
+    auto name = identifier.value().symbol;
 
     auto assignment =
         require_next_token(TokenType::equal, "Expected variable assignment",
@@ -415,91 +398,339 @@ auto parse_variable_definition(Buffer<std::vector<Token>>& tokens,
         return std::nullopt;
     }
 
-    auto value = parse_expression(tokens, diagnostics);
+    auto value = parse_expression(tokens, ast, diagnostics);
     if (!value) {
         diagnostics.push_error("Expected variable value",
                                assignment.value().source);
         return std::nullopt;
     }
 
-    return Node{
+    return ast.add(
         VariableDefinition{name,
-                           std::make_shared<Node>(value.value()),
-                           {varToken, identifier.value(), assignment.value()}}};
+                           value.value(),
+                           {varToken, identifier.value(), assignment.value()}});
 }
 
-auto parse_expression(Buffer<std::vector<Token>>& tokens,
-                      Diagnostics& diagnostics) -> std::optional<Node> {
-    std::cerr << "Parsing expression " << tokens.peek() << '\n';
-    std::optional<Node> value;
-    switch (tokens.peek().type) {
+// Where parse_expression() is within an expression.
+enum class ExpressionState {
+    // Expecting the start of an expression.
+    operand,
+    // After an operand or a call, which `.member` accesses may follow.
+    chain,
+    // After a whole expression.
+    parsed,
+    // Inside the argument list of the innermost pending call.
+    arguments,
+    // After an expression that failed to parse.
+    failed,
+};
+
+// Parses the start of an expression into `value`. An identifier followed by
+// a paren starts a call, which is pushed on `calls` to collect its arguments.
+template <TokenInput Tokens>
+auto parse_operand(Tokens& tokens, Ast& ast, Diagnostics& diagnostics,
+                   std::vector<PendingCall>& calls,
+                   std::optional<NodeId>& value) -> ExpressionState {
+    const auto next = peek_type(tokens);
+    if (!next.has_value()) {
+        // Whatever expected the expression reports it missing.
+        return ExpressionState::failed;
+    }
+    XLANG_TRACE(parser, debug, "Parsing expression " << tokens.peek());
+    switch (next.value()) {
     case TokenType::identifier: {
-        value = parse_identifier_or_function_call(tokens.peek(), tokens,
-                                                  diagnostics);
+        const auto identifier = tokens.pop();
+        if (peek_token_type(tokens, TokenType::paren_open)) {
+            calls.push_back(PendingCall{identifier, tokens.pop(),
+                                        std::nullopt, {}, std::nullopt,
+                                        std::nullopt});
+            return ExpressionState::arguments;
+        }
+        value = ast.add(Identifier{identifier.symbol, {identifier}});
     } break;
     case TokenType::structure: {
-        value = parse_struct_definition(tokens.pop(), tokens, diagnostics);
+        value =
+            parse_struct_definition(tokens.pop(), tokens, ast, diagnostics);
     } break;
     case TokenType::function:
     case TokenType::external: {
-        value = parse_function_definition(tokens.pop(), tokens, diagnostics);
+        value = parse_function_definition(tokens.pop(), tokens, ast,
+                                          diagnostics);
     } break;
     case TokenType::variable: {
-        value = parse_variable_definition(tokens, diagnostics, tokens.pop());
+        value = parse_variable_definition(tokens, ast, diagnostics,
+                                          tokens.pop());
     } break;
     case TokenType::string_literal: {
         auto token = tokens.pop();
-        value = std::make_optional(
-            Node{StringLiteral{std::get<std::string>(token.value), {token}}});
+        value = ast.add(StringLiteral{token.value, {token}});
     } break;
     case TokenType::integer_literal: {
         auto token = tokens.pop();
-        value = std::make_optional(Node{IntegerLiteral{
-            stoull(std::get<std::string>(token.value)), {token}}});
+        uint64_t integer = 0;
+        const auto [end, error] =
+            std::from_chars(token.value.data(),
+                            token.value.data() + token.value.size(), integer);
+        if (error != std::errc{}) {
+            diagnostics.push_error("Integer literal out of range",
+                                   token.source);
+            return ExpressionState::failed;
+        }
+        value = ast.add(IntegerLiteral{integer, {token}});
     } break;
     default: {
         diagnostics.push_error("Unexpected token: " +
                                    TokenType_to_string(tokens.peek().type),
                                tokens.peek().source);
-        return std::nullopt;
+        return ExpressionState::failed;
     } break;
     }
 
-    if (!value.has_value()) {
-        return std::nullopt;
-    }
+    return value.has_value() ? ExpressionState::chain
+                             : ExpressionState::failed;
+}
 
+// Extends `value` with `.member` accesses. A member call is pushed on `calls`
+// with `value` as its base, and the chain resumes once the call is finished.
+template <TokenInput Tokens>
+auto parse_chain(Tokens& tokens, Ast& ast, Diagnostics& diagnostics,
+                 std::vector<PendingCall>& calls,
+                 std::optional<NodeId>& value) -> ExpressionState {
     while (peek_token_type(tokens, TokenType::dot)) {
         const auto dot_token = tokens.pop();
-        const auto member =
-            parse_identifier_or_function_call(dot_token, tokens, diagnostics);
-
-        if (!member.has_value()) {
+        const auto identifier =
+            require_next_token(TokenType::identifier, "Expected identifier",
+                               dot_token, tokens, diagnostics);
+        if (!identifier.has_value()) {
             diagnostics.push_error("Expected chained expression",
                                    dot_token.source);
-            return std::nullopt;
+            return ExpressionState::failed;
+        }
+
+        if (peek_token_type(tokens, TokenType::paren_open)) {
+            calls.push_back(PendingCall{identifier.value(), tokens.pop(),
+                                        std::nullopt, {}, value, dot_token});
+            return ExpressionState::arguments;
         }
 
-        value = Node{MemberAccess{std::make_shared<Node>(value.value()),
-                                  std::make_shared<Node>(member.value()),
-                                  {dot_token}}};
+        const auto member = ast.add(
+            Identifier{identifier.value().symbol, {identifier.value()}});
+        value = ast.add(MemberAccess{value.value(), member, {dot_token}});
     }
+    return ExpressionState::parsed;
+}
 
-    std::cerr << "Parsed expression " << value.value() << '\n';
+// Steps through the argument list of the innermost pending call, finishing
+// the call at its closing paren.
+template <TokenInput Tokens>
+auto parse_arguments(Tokens& tokens, Ast& ast, Diagnostics& diagnostics,
+                     std::vector<PendingCall>& calls,
+                     std::optional<NodeId>& value) -> ExpressionState {
+    auto& call = calls.back();
+    const auto next = peek_type(tokens);
+    if (!next.has_value()) {
+        diagnostics.push_error("Expected function arguments",
+                               call.paren_open.source);
+        if (call.dot.has_value()) {
+            diagnostics.push_error("Expected chained expression",
+                                   call.dot.value().source);
+        }
+        calls.pop_back();
+        return ExpressionState::failed;
+    }
+
+    if (next == TokenType::comma) {
+        call.paren_close = tokens.pop();
+    } else if (next == TokenType::paren_close) {
+        call.paren_close = tokens.pop();
+        value = finish_call(std::move(call), ast);
+        calls.pop_back();
+        return ExpressionState::chain;
+    }
+    return ExpressionState::operand;
+}
 
-    return value;
+// Calls nest through their arguments, and chains grow a member at a time,
+// as deep as generated code likes. Neither recurses: calls waiting on their
+// arguments are kept on an explicit stack instead.
+template <TokenInput Tokens>
+auto parse_expression(Tokens& tokens, Ast& ast, Diagnostics& diagnostics)
+    -> std::optional<NodeId> {
+    auto calls = std::vector<PendingCall>{};
+    std::optional<NodeId> value;
+    auto state = ExpressionState::operand;
+    while (true) {
+        switch (state) {
+        case ExpressionState::operand:
+            value = std::nullopt;
+            state = parse_operand(tokens, ast, diagnostics, calls, value);
+            break;
+        case ExpressionState::chain:
+            state = parse_chain(tokens, ast, diagnostics, calls, value);
+            break;
+        case ExpressionState::parsed:
+            XLANG_TRACE(parser, debug,
+                        "Parsed expression " << AstNode{&ast, value.value()});
+            if (calls.empty()) {
+                return value;
+            }
+            calls.back().arguments.push_back(value.value());
+            state = ExpressionState::arguments;
+            break;
+        case ExpressionState::arguments:
+            state = parse_arguments(tokens, ast, diagnostics, calls, value);
+            break;
+        case ExpressionState::failed: {
+            // The failed expression was an argument of the innermost call,
+            // which ends there. It still counts as parsed if it got past a
+            // comma.
+            if (calls.empty()) {
+                return std::nullopt;
+            }
+            auto call = std::move(calls.back());
+            calls.pop_back();
+            diagnostics.push_error("Failed to parse function arguments",
+                                   call.paren_open.source);
+            if (call.paren_close.has_value()) {
+                value = finish_call(std::move(call), ast);
+                state = ExpressionState::chain;
+            } else if (call.dot.has_value()) {
+                diagnostics.push_error("Expected chained expression",
+                                       call.dot.value().source);
+            }
+        } break;
+        }
+    }
 }
 
-auto xlang::parse(Buffer<std::vector<Token>> tokens, Diagnostics& diagnostics)
-    -> std::vector<Node> {
-    std::vector<Node> expressions{};
+// Parses top-level expressions until `tokens` runs out. Returns false if any
+// of them failed to parse.
+template <TokenInput Tokens>
+auto parse_expressions(Tokens& tokens, Ast& ast,
+                       Diagnostics& diagnostics,
+                       std::vector<NodeId>& expressions) -> bool {
+    bool parsed = true;
     while (!tokens.empty()) {
-        auto node = parse_expression(tokens, diagnostics);
+        auto node = parse_expression(tokens, ast, diagnostics);
         if (node.has_value()) {
             expressions.push_back(node.value());
         } else {
+            parsed = false;
             tokens.safe_pop();
         }
     }
-    return expressions;
+    return parsed;
+}
+
+template <TokenInput Tokens>
+auto parse_all(Tokens& tokens, Ast& ast, Diagnostics& diagnostics)
+    -> Range<NodeId> {
+    std::vector<NodeId> expressions{};
+    parse_expressions(tokens, ast, diagnostics, expressions);
+    return ast.add_list(std::move(expressions));
+}
+
+namespace {
+
+// Splits `tokens` into groups of whole top-level declarations, each at least
+// `group_size` tokens long except for the last. Only braces are matched, so
+// malformed input can produce groups that don't parse on their own.
+auto declaration_groups(const TokenStream& tokens, size_t group_size)
+    -> std::vector<size_t> {
+    auto starts = std::vector<size_t>{0};
+    size_t depth = 0;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        switch (tokens.type(i)) {
+        case TokenType::curly_open:
+            ++depth;
+            break;
+        case TokenType::curly_close:
+            depth = depth == 0 ? 0 : depth - 1;
+            break;
+        case TokenType::function:
+            if (tokens.type(i - 1) == TokenType::external) {
+                break;
+            }
+            [[fallthrough]];
+        case TokenType::external:
+        case TokenType::structure:
+            if (depth == 0 && i - starts.back() >= group_size) {
+                starts.push_back(i);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    starts.push_back(tokens.size());
+    return starts;
+}
+
+struct Group {
+    Ast ast;
+    Diagnostics diagnostics;
+    std::vector<NodeId> nodes;
+    // False if any expression failed to parse.
+    bool parsed = false;
+};
+
+} // namespace
+
+auto xlang::parse(const TokenStream& tokens, Ast& ast,
+                  Diagnostics& diagnostics) -> Range<NodeId> {
+    auto cursor = TokenCursor{tokens};
+    return parse_all(cursor, ast, diagnostics);
+}
+
+auto xlang::parse_parallel(const TokenStream& tokens, Ast& ast,
+                           Diagnostics& diagnostics, ThreadPool& pool,
+                           size_t group_size) -> Range<NodeId> {
+    if (pool.size() == 1) {
+        return parse(tokens, ast, diagnostics);
+    }
+    const auto starts = declaration_groups(tokens, group_size);
+    const auto count = starts.size() - 1;
+    if (count <= 1) {
+        return parse(tokens, ast, diagnostics);
+    }
+    XLANG_TRACE(parser, info,
+                "Parsing " << tokens.size() << " tokens in " << count
+                           << " groups on " << pool.size() << " threads");
+
+    auto groups = std::vector<Group>(count);
+    pool.for_each(count, [&](size_t i) {
+        auto& group = groups[i];
+        auto cursor = TokenCursor{tokens, starts[i], starts[i + 1]};
+        group.parsed = parse_expressions(cursor, group.ast,
+                                         group.diagnostics, group.nodes);
+    });
+
+    // A group that parses without errors on its own parses the same way in
+    // context, since nothing looks past the end of a declaration. From the
+    // first group with errors on, recovery may cross group boundaries, so the
+    // rest is parsed again serially and only its diagnostics are reported.
+    std::vector<NodeId> nodes;
+    size_t i = 0;
+    for (; i < count && groups[i].parsed && groups[i].diagnostics.size() == 0;
+         ++i) {
+        ast.append(std::move(groups[i].ast), groups[i].nodes);
+        nodes.insert(nodes.end(), groups[i].nodes.begin(),
+                     groups[i].nodes.end());
+    }
+    if (i < count) {
+        auto cursor = TokenCursor{tokens, starts[i], tokens.size()};
+        parse_expressions(cursor, ast, diagnostics, nodes);
+    }
+    return ast.add_list(std::move(nodes));
+}
+
+auto xlang::parse(Lexer& lexer, Ast& ast, Diagnostics& diagnostics)
+    -> Range<NodeId> {
+    auto cursor = LexerCursor{lexer};
+    return parse_all(cursor, ast, diagnostics);
+}
+
+auto xlang::parse(Buffer<std::vector<Token>> tokens, Ast& ast,
+                  Diagnostics& diagnostics) -> Range<NodeId> {
+    return parse_all(tokens, ast, diagnostics);
 }
@@ -1,19 +1,43 @@
 #pragma once
 
+#include "core/lexer/lexer.h"
 #include "core/lexer/token.h"
+#include "core/lexer/token_stream.h"
 #include "core/util/buffer.h"
 #include "core/util/diagnostics.h"
+#include "core/util/thread_pool.h"
 #include "node.h"
 #include <vector>
 
 namespace xlang {
 
-auto parse(Buffer<std::vector<Token>> tokens, Diagnostics& diagnostics)
-    -> std::vector<Node>;
+// Every parse() adds the nodes it parses to `ast` and returns the top-level
+// ones. Several files can be parsed into the same Ast.
 
-inline auto parse(std::vector<Token> tokens, Diagnostics& diagnostics)
-    -> std::vector<Node> {
-    return parse(Buffer<std::vector<Token>>(std::move(tokens)), diagnostics);
+auto parse(const TokenStream& tokens, Ast& ast, Diagnostics& diagnostics)
+    -> Range<NodeId>;
+
+// Pulls tokens from `lexer` as parsing needs them, so lexing and parsing are
+// interleaved and only a few tokens are held at a time.
+auto parse(Lexer& lexer, Ast& ast, Diagnostics& diagnostics) -> Range<NodeId>;
+
+constexpr size_t PARALLEL_PARSE_GROUP_SIZE = size_t{1} << 14;
+
+// Splits `tokens` at top-level declarations into groups of about `group_size`
+// tokens and parses the groups concurrently on `pool`. The resulting Ast, and
+// the diagnostics, are the same as parse()'s.
+auto parse_parallel(const TokenStream& tokens, Ast& ast,
+                    Diagnostics& diagnostics, ThreadPool& pool,
+                    size_t group_size = PARALLEL_PARSE_GROUP_SIZE)
+    -> Range<NodeId>;
+
+auto parse(Buffer<std::vector<Token>> tokens, Ast& ast,
+           Diagnostics& diagnostics) -> Range<NodeId>;
+
+inline auto parse(std::vector<Token> tokens, Ast& ast,
+                  Diagnostics& diagnostics) -> Range<NodeId> {
+    return parse(Buffer<std::vector<Token>>(std::move(tokens)), ast,
+                 diagnostics);
 }
 
 } // namespace xlang
@@ -1,6 +1,15 @@
+#include "ast_cache.h"
 #include "parser.h"
+#include <algorithm>
+#include <filesystem>
 #include <gtest/gtest.h>
 #include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
 
 using namespace xlang;
 using namespace xlang;
@@ -19,27 +28,301 @@ TEST(ParserTest, TestParsing) {
         Token{TokenType::string_literal, "Hello, world!", source},
         Token{TokenType::paren_close, source},
         Token{TokenType::curly_close, source}};
-    auto ast = parse(tokens, diagnostics);
-    auto expected = std::vector<Node>{{FunctionDefinition{
-        "main",
+    auto ast = Ast{};
+    const auto roots = parse(tokens, ast, diagnostics);
+
+    auto expected = Ast{};
+    const auto argument = expected.add(StringLiteral{
+        "Hello, world!",
+        {Token{TokenType::string_literal, "Hello, world!", source}}});
+    const auto call = expected.add(FunctionCall{
+        intern("print"),
+        expected.add_list(std::vector{argument}),
+        {Token{TokenType::identifier, "print", source},
+         Token{TokenType::paren_open, source},
+         Token{TokenType::paren_close, source}}});
+    const auto main = expected.add(FunctionDefinition{
+        intern("main"),
         false,
         false,
-        std::vector<FunctionDefinition::Parameter>{},
+        {},
+        std::nullopt,
+        expected.add_list(std::vector{call}),
         std::nullopt,
-        std::vector<Node>{{FunctionCall{
-            "print",
-            std::vector<Node>{StringLiteral{
-                "Hello, world!",
-                {Token{TokenType::string_literal, "Hello, world!", source}}}},
-            {Token{TokenType::identifier, "print", source},
-             Token{TokenType::paren_open, source},
-             Token{TokenType::paren_close, source}}}}},
-        nullptr,
         {
             std::nullopt,
             Token{TokenType::function, source},
             Token{TokenType::identifier, "main", source},
-        }}}};
-    ASSERT_EQ(ast, expected);
+        }});
+    const auto expected_roots = expected.add_list(std::vector{main});
+
+    ASSERT_TRUE(ast == expected);
+    ASSERT_EQ(roots, expected_roots);
+    ASSERT_EQ(diagnostics.size(), 0);
+}
+
+TEST(ParserTest, TestStreamingParseMatchesTokenStream) {
+    const std::string source = R"(extern fn printf(format: Pointer<UInt8>, ...)
+fn main() {
+    printf("%d %d", add(1, 2), 3)
+}
+)";
+
+    auto expected = Ast{};
+    auto diagnostics = Diagnostics{};
+    const auto expected_roots =
+        parse(lex(source, diagnostics), expected, diagnostics);
+
+    auto streamed = Ast{};
+    auto streaming_diagnostics = Diagnostics{};
+    auto lexer = Lexer{source, streaming_diagnostics};
+    const auto roots = parse(lexer, streamed, streaming_diagnostics);
+    ASSERT_TRUE(streamed == expected);
+    ASSERT_EQ(roots, expected_roots);
+    ASSERT_EQ(roots.size(), 2);
     ASSERT_EQ(diagnostics.size(), 0);
+    ASSERT_EQ(streaming_diagnostics.size(), 0);
+}
+
+TEST(ParserTest, TestNodesAreStoredByType) {
+    const std::string source = R"(fn main() -> Int32 {
+    var value = first.second.third()
+    return 42
+})";
+
+    auto ast = Ast{};
+    auto diagnostics = Diagnostics{};
+    const auto roots = parse(lex(source, diagnostics), ast, diagnostics);
+    ASSERT_EQ(diagnostics.size(), 0);
+    ASSERT_EQ(roots.size(), 1);
+
+    const auto& main = ast.get<FunctionDefinition>(ast[roots][0]);
+    ASSERT_EQ(main.body.size(), 1);
+    ASSERT_TRUE(main.return_value.has_value());
+    ASSERT_EQ(ast.get<IntegerLiteral>(main.return_value.value()).value, 42);
+
+    // Chains nest to the left: (first.second).third().
+    const auto& variable = ast.get<VariableDefinition>(ast[main.body][0]);
+    const auto& outer = ast.get<MemberAccess>(variable.value);
+    ASSERT_EQ(ast.get<FunctionCall>(outer.member).name, intern("third"));
+    const auto& inner = ast.get<MemberAccess>(outer.base);
+    ASSERT_EQ(ast.get<Identifier>(inner.base).name, intern("first"));
+    ASSERT_EQ(ast.get<Identifier>(inner.member).name, intern("second"));
+
+    // Each type's nodes are contiguous, in the order they were parsed.
+    ASSERT_EQ(ast.all<Identifier>().size(), 2);
+    ASSERT_EQ(ast.all<MemberAccess>().size(), 2);
+    ASSERT_EQ(ast.all<MemberAccess>()[0], inner);
+    ASSERT_EQ(ast.all<MemberAccess>()[1], outer);
+
+    size_t visited = 0;
+    visit_all(ast, [&](const auto& node, NodeId id) {
+        ASSERT_EQ(id.type, std::remove_cvref_t<decltype(node)>::TYPE);
+        const void* visited_node = visit(
+            ast, id, [](const auto& same) -> const void* { return &same; });
+        ASSERT_EQ(visited_node, &node);
+        ++visited;
+    });
+    ASSERT_EQ(visited, ast.size());
+    ASSERT_EQ(visited, 8);
+}
+
+// Chains and nested calls are parsed, printed and located without recursing,
+// so nesting far deeper than the call stack allows still works.
+TEST(ParserTest, TestDeepNesting) {
+    constexpr size_t DEPTH = 100000;
+    auto chain = std::string{"fn main() {\n    value"};
+    for (size_t i = 0; i < DEPTH; ++i) {
+        chain += ".link";
+    }
+    chain += "()\n}\n";
+    auto call = std::string{"fn main() {\n    "};
+    for (size_t i = 0; i < DEPTH; ++i) {
+        call += "f(";
+    }
+    call += "1" + std::string(DEPTH, ')') + "\n}\n";
+
+    for (const auto& source : {chain, call}) {
+        auto ast = Ast{};
+        auto diagnostics = Diagnostics{};
+        const auto roots = parse(lex(source, diagnostics), ast, diagnostics);
+        ASSERT_EQ(diagnostics.size(), 0);
+        ASSERT_EQ(roots.size(), 1);
+
+        const auto& main = ast.get<FunctionDefinition>(ast[roots][0]);
+        ASSERT_EQ(main.body.size(), 1);
+        auto id = ast[main.body][0];
+        size_t depth = 0;
+        while (id.type != NodeType::identifier &&
+               id.type != NodeType::integer_literal) {
+            id = id.type == NodeType::member_access
+                     ? ast.get<MemberAccess>(id).base
+                     : ast[ast.get<FunctionCall>(id).arguments][0];
+            ++depth;
+        }
+        ASSERT_EQ(depth, DEPTH);
+        ASSERT_EQ(node_source(ast, ast[main.body][0]).line, 1);
+
+        auto printed = std::ostringstream{};
+        printed << AstNode{&ast, ast[roots][0]};
+        ASSERT_GT(printed.str().size(), DEPTH);
+    }
+}
+
+TEST(ParserTest, TestParallelParsingMatchesSerial) {
+    std::string valid = "extern fn printf(format: Pointer<UInt8>, ...)\n";
+    for (int i = 0; i < 40; ++i) {
+        const auto number = std::to_string(i);
+        valid += "struct S" + number + " {\n    a: Int32\n    b: UInt8\n}\n";
+        valid += "fn f" + number + "(x: Int32) -> Int32 {\n";
+        valid += "    printf(\"%d\", x.y.z(1, 2))\n    return " + number;
+        valid += "\n}\n";
+    }
+    // Errors force the groups from the first broken one on to be parsed
+    // serially, and some of them cross group boundaries.
+    auto missing_brace = valid;
+    missing_brace.erase(missing_brace.find("}\nstruct S7"), 1);
+    auto stray_tokens = valid;
+    stray_tokens.insert(stray_tokens.find("fn f20"), "} ) , fn\n");
+
+    auto pool = ThreadPool{4};
+    for (const auto& source : {valid, missing_brace, stray_tokens}) {
+        auto serial = Ast{};
+        auto serial_diagnostics = Diagnostics{};
+        const auto tokens = lex(source, serial_diagnostics);
+        const auto serial_roots = parse(tokens, serial, serial_diagnostics);
+
+        for (const size_t group_size : {1, 16, 100, 1 << 14}) {
+            auto parallel = Ast{};
+            auto diagnostics = Diagnostics{};
+            const auto roots = parse_parallel(tokens, parallel, diagnostics,
+                                              pool, group_size);
+            ASSERT_TRUE(parallel == serial) << group_size;
+            ASSERT_EQ(roots, serial_roots);
+
+            ASSERT_EQ(diagnostics.size(), serial_diagnostics.size());
+            auto expected = serial_diagnostics.begin();
+            for (const auto& diagnostic : diagnostics) {
+                ASSERT_EQ(diagnostic.message, expected->message);
+                ASSERT_EQ(diagnostic.source, expected->source);
+                ++expected;
+            }
+        }
+    }
+}
+
+namespace {
+
+const std::string CACHED_SOURCE =
+    "extern fn printf(format: Pointer<UInt8>, ...) -> Int32\n"
+    "struct Point {\n    x: Int32\n    y: Int32\n}\n"
+    "fn main() -> Int32 {\n"
+    "    var p = point.x\n"
+    "    printf(\"%d\\n\", a.b.c(1, f(2)))\n"
+    "    return 0\n"
+    "}\n";
+
+auto printed(const Ast& ast, std::span<const NodeId> roots) -> std::string {
+    auto out = std::ostringstream{};
+    for (const auto id : roots) {
+        out << AstNode{&ast, id} << "\n";
+    }
+    return out.str();
+}
+
+} // namespace
+
+TEST(ParserTest, TestAstSerializationRoundTrip) {
+    auto diagnostics = Diagnostics{};
+    const auto tokens = lex(CACHED_SOURCE, diagnostics);
+    auto ast = Ast{};
+    const auto roots = parse(tokens, ast, diagnostics);
+    ASSERT_EQ(diagnostics.size(), 0);
+    const auto bytes = serialize_ast(ast, roots, CACHED_SOURCE);
+
+    auto loaded = Ast{};
+    const auto loaded_roots = deserialize_ast(bytes, CACHED_SOURCE, loaded);
+    ASSERT_TRUE(loaded_roots.has_value());
+    ASSERT_TRUE(loaded == ast);
+    ASSERT_TRUE(std::ranges::equal(loaded[loaded_roots.value()], ast[roots]));
+
+    // Loading into an Ast that already has nodes shifts the new ones past
+    // them and leaves the old ones alone.
+    const std::string other_source = "fn f(x: Int32) { g(x.y) }";
+    const auto other_tokens = lex(other_source, diagnostics);
+    auto combined = Ast{};
+    const auto other_roots = parse(other_tokens, combined, diagnostics);
+    const auto appended_roots =
+        deserialize_ast(bytes, CACHED_SOURCE, combined);
+    ASSERT_TRUE(appended_roots.has_value());
+    ASSERT_EQ(combined.size(), ast.size() + 5);
+    ASSERT_EQ(printed(combined, combined[other_roots]),
+              "function_definition(f,x:Int32,function_call(g,member_access("
+              "identifier(x) > identifier(y))))\n");
+    ASSERT_EQ(printed(combined, combined[appended_roots.value()]),
+              printed(ast, ast[roots]));
+}
+
+TEST(ParserTest, TestAstSerializationRejectsMismatches) {
+    auto diagnostics = Diagnostics{};
+    const auto tokens = lex(CACHED_SOURCE, diagnostics);
+    auto ast = Ast{};
+    const auto roots = parse(tokens, ast, diagnostics);
+    const auto bytes = serialize_ast(ast, roots, CACHED_SOURCE);
+
+    auto loaded = Ast{};
+    auto edited = CACHED_SOURCE;
+    edited[edited.find("point")] = 'q';
+    ASSERT_FALSE(deserialize_ast(bytes, edited, loaded).has_value());
+    ASSERT_FALSE(
+        deserialize_ast(bytes, CACHED_SOURCE + " ", loaded).has_value());
+
+    auto other_version = bytes;
+    other_version[4] = static_cast<char>(other_version[4] + 1);
+    ASSERT_FALSE(
+        deserialize_ast(other_version, CACHED_SOURCE, loaded).has_value());
+
+    for (size_t size = 0; size < bytes.size(); ++size) {
+        ASSERT_FALSE(
+            deserialize_ast(std::string_view{bytes}.substr(0, size),
+                            CACHED_SOURCE, loaded)
+                .has_value())
+            << size;
+    }
+    ASSERT_EQ(loaded.size(), 0);
+
+    // Damage anywhere must be caught or decode to something well-formed; it
+    // mustn't crash.
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        auto damaged = bytes;
+        damaged[i] = static_cast<char>(~damaged[i]);
+        auto damaged_ast = Ast{};
+        if (const auto damaged_roots =
+                deserialize_ast(damaged, CACHED_SOURCE, damaged_ast)) {
+            printed(damaged_ast, damaged_ast[damaged_roots.value()]);
+        }
+    }
+}
+
+TEST(ParserTest, TestAstCache) {
+    const auto directory = std::filesystem::temp_directory_path() /
+                           ("xlang_ast_cache_" + std::to_string(::getpid()));
+    std::filesystem::remove_all(directory);
+    const auto cache = AstCache{directory.string()};
+
+    auto diagnostics = Diagnostics{};
+    const auto tokens = lex(CACHED_SOURCE, diagnostics);
+    auto ast = Ast{};
+    const auto roots = parse(tokens, ast, diagnostics);
+
+    auto loaded = Ast{};
+    ASSERT_FALSE(cache.load(CACHED_SOURCE, loaded).has_value());
+    ASSERT_TRUE(cache.store(CACHED_SOURCE, ast, roots));
+    const auto loaded_roots = cache.load(CACHED_SOURCE, loaded);
+    ASSERT_TRUE(loaded_roots.has_value());
+    ASSERT_TRUE(loaded == ast);
+    ASSERT_TRUE(std::ranges::equal(loaded[loaded_roots.value()], ast[roots]));
+    ASSERT_FALSE(cache.load(CACHED_SOURCE + "\n", loaded).has_value());
+
+    std::filesystem::remove_all(directory);
 }
@@ -0,0 +1,52 @@
+#include "allocation_counter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<size_t> allocations{0};
+
+} // namespace
+
+auto xlang::allocation_count() -> size_t {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// NOLINTBEGIN(cppcoreguidelines-no-malloc)
+auto operator new(size_t size) -> void* {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc{};
+}
+
+auto operator new(size_t size, std::align_val_t alignment) -> void* {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    const auto align = static_cast<size_t>(alignment);
+    const auto rounded = std::max((size + align - 1) / align * align, align);
+    if (void* pointer = std::aligned_alloc(align, rounded)) {
+        return pointer;
+    }
+    throw std::bad_alloc{};
+}
+
+auto operator delete(void* pointer) noexcept -> void { std::free(pointer); }
+
+auto operator delete(void* pointer, size_t /*size*/) noexcept -> void {
+    std::free(pointer);
+}
+
+auto operator delete(void* pointer, std::align_val_t /*alignment*/) noexcept
+    -> void {
+    std::free(pointer);
+}
+
+auto operator delete(void* pointer, size_t /*size*/,
+                     std::align_val_t /*alignment*/) noexcept -> void {
+    std::free(pointer);
+}
+// NOLINTEND(cppcoreguidelines-no-malloc)
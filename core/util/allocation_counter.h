@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+
+namespace xlang {
+
+// Number of calls to the global operator new made by this process so far.
+// Only binaries that link //core/util:allocation_counter are counted.
+auto allocation_count() -> size_t;
+
+} // namespace xlang
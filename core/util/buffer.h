@@ -48,6 +48,8 @@ template <Container T> class Buffer {
     [[nodiscard]] inline auto empty() const -> bool {
         return position >= storage.size();
     }
+
+    [[nodiscard]] inline auto offset() const -> size_t { return position; }
 };
 
 } // namespace xlang
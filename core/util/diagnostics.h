@@ -18,7 +18,6 @@ struct Diagnostic {
 class Diagnostics {
   public:
     inline auto push_error(const std::string& message, Source source) -> void {
-        std::cerr << message << '\n';
         diagnostics.push_back({DiagnosticType::error, message, source});
     }
 
@@ -31,6 +30,11 @@ class Diagnostics {
         diagnostics.push_back({DiagnosticType::note, message, source});
     }
 
+    // Adds a diagnostic that was collected and reported elsewhere.
+    inline auto push(Diagnostic diagnostic) -> void {
+        diagnostics.push_back(std::move(diagnostic));
+    }
+
     inline auto begin() -> std::vector<Diagnostic>::iterator {
         return diagnostics.begin();
     }
@@ -0,0 +1,95 @@
+#include "source_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace xlang;
+
+auto SourceFile::open(const std::string& path) -> std::optional<SourceFile> {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+
+    struct stat info {};
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        return std::nullopt;
+    }
+
+    if (!S_ISREG(info.st_mode)) {
+        auto file = read_stream(fd, path);
+        ::close(fd);
+        return file;
+    }
+
+    auto file = SourceFile{path};
+    if (info.st_size > 0) {
+        const auto size = static_cast<size_t>(info.st_size);
+        void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        file.mapping = mapping;
+        file.mapping_size = size;
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    return file;
+}
+
+auto SourceFile::read_stdin() -> std::optional<SourceFile> {
+    return read_stream(STDIN_FILENO, "<stdin>");
+}
+
+auto SourceFile::read_stream(int fd, std::string name)
+    -> std::optional<SourceFile> {
+    constexpr size_t chunk_size = 1 << 16;
+
+    auto file = SourceFile{std::move(name)};
+    size_t size = 0;
+    while (true) {
+        file.buffer.resize(size + chunk_size);
+        const auto count = ::read(fd, file.buffer.data() + size, chunk_size);
+        if (count < 0) {
+            return std::nullopt;
+        }
+        if (count == 0) {
+            break;
+        }
+        size += static_cast<size_t>(count);
+    }
+    file.buffer.resize(size);
+    return file;
+}
+
+SourceFile::SourceFile(SourceFile&& other) noexcept
+    : name{std::move(other.name)},
+      mapping{std::exchange(other.mapping, nullptr)},
+      mapping_size{std::exchange(other.mapping_size, 0)},
+      buffer{std::move(other.buffer)} {}
+
+auto SourceFile::operator=(SourceFile&& other) noexcept -> SourceFile& {
+    if (this != &other) {
+        if (mapping != nullptr) {
+            ::munmap(mapping, mapping_size);
+        }
+        name = std::move(other.name);
+        mapping = std::exchange(other.mapping, nullptr);
+        mapping_size = std::exchange(other.mapping_size, 0);
+        buffer = std::move(other.buffer);
+    }
+    return *this;
+}
+
+SourceFile::~SourceFile() {
+    if (mapping != nullptr) {
+        ::munmap(mapping, mapping_size);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace xlang {
+
+// Read-only contents of an input file. Regular files are memory-mapped so the
+// lexer can view them without copying; anything else (stdin, pipes) is read
+// into an owned buffer.
+class SourceFile {
+  public:
+    // Returns std::nullopt and leaves errno set if the file can't be read.
+    static auto open(const std::string& path) -> std::optional<SourceFile>;
+
+    static auto read_stdin() -> std::optional<SourceFile>;
+
+    SourceFile(const SourceFile&) = delete;
+    auto operator=(const SourceFile&) -> SourceFile& = delete;
+    SourceFile(SourceFile&& other) noexcept;
+    auto operator=(SourceFile&& other) noexcept -> SourceFile&;
+    ~SourceFile();
+
+    [[nodiscard]] auto path() const -> const std::string& { return name; }
+
+    [[nodiscard]] auto contents() const -> std::string_view {
+        if (mapping != nullptr) {
+            return {static_cast<const char*>(mapping), mapping_size};
+        }
+        return buffer;
+    }
+
+  private:
+    explicit SourceFile(std::string name) : name{std::move(name)} {}
+
+    static auto read_stream(int fd, std::string name)
+        -> std::optional<SourceFile>;
+
+    std::string name;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    std::string buffer;
+};
+
+} // namespace xlang
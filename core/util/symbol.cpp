@@ -0,0 +1,104 @@
+#include "symbol.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace xlang;
+
+namespace {
+
+class SymbolTable {
+  public:
+    SymbolTable() {
+        for (const auto name : BUILTIN_SYMBOL_NAMES) {
+            insert(name);
+        }
+    }
+
+    // Returns the symbol along with the table's own copy of the spelling.
+    auto intern(std::string_view name) -> std::pair<std::string_view, Symbol> {
+        {
+            const std::shared_lock lock{mutex};
+            if (const auto it = ids.find(name); it != ids.end()) {
+                return *it;
+            }
+        }
+
+        const std::unique_lock lock{mutex};
+        // Another thread may have inserted it since the shared lock was
+        // released.
+        if (const auto it = ids.find(name); it != ids.end()) {
+            return *it;
+        }
+        const auto symbol = insert(name);
+        return {names[symbol.index()], symbol};
+    }
+
+    auto name(Symbol symbol) -> std::string_view {
+        const std::shared_lock lock{mutex};
+        return names[symbol.index()];
+    }
+
+  private:
+    // Must be called with the lock held exclusively.
+    auto insert(std::string_view name) -> Symbol {
+        const auto stored = store(name);
+        const auto symbol = Symbol{static_cast<uint32_t>(names.size())};
+        names.push_back(stored);
+        ids.emplace(stored, symbol);
+        return symbol;
+    }
+
+    // Copies the spelling into a block that never moves, so the views in
+    // `names` and the keys of `ids` stay valid.
+    auto store(std::string_view name) -> std::string_view {
+        constexpr size_t block_size = size_t{64} * 1024;
+        if (name.empty()) {
+            return {};
+        }
+        if (name.size() > capacity - used) {
+            capacity = std::max(block_size, name.size());
+            blocks.push_back(std::make_unique<char[]>(capacity));
+            used = 0;
+        }
+        char* destination = blocks.back().get() + used;
+        std::copy(name.begin(), name.end(), destination);
+        used += name.size();
+        return {destination, name.size()};
+    }
+
+    std::shared_mutex mutex;
+    std::unordered_map<std::string_view, Symbol> ids;
+    std::vector<std::string_view> names;
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-c-arrays)
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t capacity = 0;
+    size_t used = 0;
+};
+
+auto table() -> SymbolTable& {
+    static SymbolTable table;
+    return table;
+}
+
+} // namespace
+
+auto Symbol::str() const -> std::string_view { return table().name(*this); }
+
+auto xlang::intern(std::string_view name) -> Symbol {
+    // Most names repeat, so a small per-thread cache answers the majority of
+    // lookups without touching the table's lock.
+    constexpr size_t cache_size = 1024;
+    thread_local auto cache =
+        std::array<std::pair<std::string_view, Symbol>, cache_size>{};
+
+    auto& entry = cache[std::hash<std::string_view>{}(name) % cache_size];
+    if (entry.first == name) {
+        return entry.second;
+    }
+    entry = table().intern(name);
+    return entry.second;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string_view>
+
+namespace xlang {
+
+// An interned name. Symbols compare and hash as 32-bit integers; the spelling
+// lives in a process-wide table for as long as the process does.
+class Symbol {
+  public:
+    constexpr Symbol() = default;
+    explicit constexpr Symbol(uint32_t id) : id{id} {}
+
+    [[nodiscard]] constexpr auto index() const -> uint32_t { return id; }
+
+    [[nodiscard]] auto str() const -> std::string_view;
+
+    auto operator==(const Symbol& other) const -> bool = default;
+
+  private:
+    uint32_t id = 0;
+};
+
+// Returns the symbol for `name`, adding it to the table if it's new. Safe to
+// call from multiple threads.
+auto intern(std::string_view name) -> Symbol;
+
+inline auto operator<<(std::ostream& os, Symbol symbol) -> std::ostream& {
+    return os << symbol.str();
+}
+
+// Names the compiler refers to directly. They're interned up front, in this
+// order, so each has a fixed ID.
+constexpr auto BUILTIN_SYMBOL_NAMES = std::array<std::string_view, 8>{
+    "", "Void", "String", "UInt8", "Int32", "Int64", "Pointer", "main",
+};
+
+namespace symbols {
+
+constexpr auto EMPTY = Symbol{0};
+constexpr auto VOID = Symbol{1};
+constexpr auto STRING = Symbol{2};
+constexpr auto UINT8 = Symbol{3};
+constexpr auto INT32 = Symbol{4};
+constexpr auto INT64 = Symbol{5};
+constexpr auto POINTER = Symbol{6};
+constexpr auto MAIN = Symbol{7};
+
+static_assert(BUILTIN_SYMBOL_NAMES[VOID.index()] == "Void");
+static_assert(BUILTIN_SYMBOL_NAMES[POINTER.index()] == "Pointer");
+static_assert(BUILTIN_SYMBOL_NAMES[MAIN.index()] == "main");
+
+} // namespace symbols
+
+} // namespace xlang
+
+template <> struct std::hash<xlang::Symbol> {
+    auto operator()(xlang::Symbol symbol) const noexcept -> size_t {
+        return std::hash<uint32_t>{}(symbol.index());
+    }
+};
@@ -0,0 +1,88 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+using namespace xlang;
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back([this] { work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        const std::lock_guard lock{mutex};
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+auto ThreadPool::default_thread_count() -> size_t {
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+auto ThreadPool::work() -> void {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock{mutex};
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+auto ThreadPool::for_each(size_t count,
+                          const std::function<void(size_t)>& task) -> void {
+    if (count == 0) {
+        return;
+    }
+
+    // Every participant claims indices from a shared counter until none are
+    // left, so uneven tasks balance themselves.
+    struct State {
+        std::atomic<size_t> next = 0;
+        std::atomic<size_t> done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    const auto state = std::make_shared<State>();
+
+    const auto run = [state, count, &task] {
+        size_t ran = 0;
+        for (auto i = state->next++; i < count; i = state->next++) {
+            task(i);
+            ++ran;
+        }
+        if (ran != 0 && (state->done += ran) == count) {
+            const std::lock_guard lock{state->mutex};
+            state->finished.notify_all();
+        }
+    };
+
+    const auto helpers = std::min(workers.size(), count - 1);
+    if (helpers != 0) {
+        {
+            const std::lock_guard lock{mutex};
+            for (size_t i = 0; i < helpers; ++i) {
+                jobs.emplace_back(run);
+            }
+        }
+        wake.notify_all();
+    }
+
+    run();
+
+    std::unique_lock lock{state->mutex};
+    state->finished.wait(lock, [&] { return state->done == count; });
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xlang {
+
+// A fixed set of worker threads for data-parallel stages of the compiler.
+class ThreadPool {
+  public:
+    // `threads` counts the calling thread, which helps out while it waits, so
+    // a pool of one runs everything inline.
+    explicit ThreadPool(size_t threads = default_thread_count());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    [[nodiscard]] auto size() const -> size_t { return workers.size() + 1; }
+
+    // Calls `task(i)` for every i in [0, count) and returns once all calls
+    // have. Indices are handed out in increasing order, but the calls may run
+    // concurrently and finish in any order.
+    auto for_each(size_t count, const std::function<void(size_t)>& task)
+        -> void;
+
+    static auto default_thread_count() -> size_t;
+
+  private:
+    auto work() -> void;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> jobs;
+    bool stopping = false;
+};
+
+} // namespace xlang
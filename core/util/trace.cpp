@@ -0,0 +1,75 @@
+#include "trace.h"
+#include <iostream>
+#include <mutex>
+#include <optional>
+
+using namespace xlang;
+using namespace xlang::trace;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::array<std::atomic<Level>, static_cast<size_t>(Category::count)>
+    xlang::trace::levels{};
+
+namespace {
+
+template <typename Enum>
+auto parse_enum(std::string_view name, auto to_string) -> std::optional<Enum> {
+    for (size_t i = 0; i < static_cast<size_t>(Enum::count); ++i) {
+        const auto value = static_cast<Enum>(i);
+        if (to_string(value) == name) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+auto xlang::trace::set_level(Category category, Level level) -> void {
+    levels[static_cast<size_t>(category)].store(level,
+                                                std::memory_order_relaxed);
+}
+
+auto xlang::trace::configure(std::string_view settings) -> bool {
+    bool valid = true;
+    while (!settings.empty()) {
+        const auto comma = settings.find(',');
+        const auto setting = settings.substr(0, comma);
+        settings = comma == std::string_view::npos ? std::string_view{}
+                                                   : settings.substr(comma + 1);
+
+        const auto equals = setting.find('=');
+        if (equals == std::string_view::npos) {
+            valid = false;
+            continue;
+        }
+        const auto level = parse_enum<Level>(setting.substr(equals + 1),
+                                             Level_to_string);
+        if (!level.has_value()) {
+            valid = false;
+            continue;
+        }
+
+        const auto name = setting.substr(0, equals);
+        if (name == "all") {
+            for (auto& category_level : levels) {
+                category_level.store(level.value(), std::memory_order_relaxed);
+            }
+            continue;
+        }
+        const auto category = parse_enum<Category>(name, Category_to_string);
+        if (!category.has_value()) {
+            valid = false;
+            continue;
+        }
+        set_level(category.value(), level.value());
+    }
+    return valid;
+}
+
+auto xlang::trace::write(Category category, const std::string& message)
+    -> void {
+    static std::mutex mutex;
+    const auto lock = std::lock_guard{mutex};
+    std::cerr << '[' << category << "] " << message << '\n';
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "core/util/enum.h"
+#include <array>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// Building with -DXLANG_TRACING=0 compiles every trace point out, arguments
+// and all.
+#ifndef XLANG_TRACING
+#define XLANG_TRACING 1
+#endif
+
+namespace xlang::trace {
+
+ENUM_CLASS(Category, lexer, parser, ir, llvm);
+
+// Each level includes the ones before it.
+ENUM_CLASS(Level, off, info, debug);
+
+constexpr bool ENABLED = XLANG_TRACING != 0;
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+extern std::array<std::atomic<Level>, static_cast<size_t>(Category::count)>
+    levels;
+
+inline auto enabled(Category category, Level level) -> bool {
+    if constexpr (!ENABLED) {
+        return false;
+    }
+    return level <= levels[static_cast<size_t>(category)].load(
+                        std::memory_order_relaxed);
+}
+
+auto set_level(Category category, Level level) -> void;
+
+// Applies comma-separated `category=level` settings, such as
+// "parser=debug,ir=info". `all` stands for every category. Returns false,
+// after applying the valid settings, if any setting is malformed.
+auto configure(std::string_view settings) -> bool;
+
+// Writes one line to stderr, prefixed with the category.
+auto write(Category category, const std::string& message) -> void;
+
+} // namespace xlang::trace
+
+// Streams its arguments into a trace line, e.g.
+//     XLANG_TRACE(parser, debug, "Parsed " << node);
+// The arguments are only evaluated when the category is traced at `level`.
+#define XLANG_TRACE(category, level, ...)                                      \
+    do {                                                                       \
+        if constexpr (::xlang::trace::ENABLED) {                               \
+            if (::xlang::trace::enabled(::xlang::trace::Category::category,    \
+                                        ::xlang::trace::Level::level)) {       \
+                std::ostringstream trace_line;                                 \
+                trace_line << __VA_ARGS__;                                     \
+                ::xlang::trace::write(::xlang::trace::Category::category,      \
+                                      trace_line.str());                       \
+            }                                                                  \
+        }                                                                      \
+    } while (false)
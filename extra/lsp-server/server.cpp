@@ -5,7 +5,10 @@
 #include <boost/json.hpp>
 #include <iostream>
 #include <optional>
+#include <span>
 #include <string>
+#include <variant>
+#include <vector>
 
 auto serialize_response(boost::json::object result, int64_t id) -> std::string {
     boost::json::object message;
@@ -90,8 +93,9 @@ auto publish_diagnostics(const Context& ctx, const TextDocument file)
     -> boost::json::object {
     auto diagnostics = xlang::Diagnostics{};
     auto tokens = xlang::lex(file.data, diagnostics);
-    auto ast = xlang::parse(tokens, diagnostics);
-    auto module = xlang::ir::compile(ast, diagnostics);
+    auto ast = xlang::Ast{};
+    const auto roots = xlang::parse(tokens, ast, diagnostics);
+    auto module = xlang::ir::compile(ast, ast[roots], diagnostics);
     return boost::json::object{
         {"method", "textDocument/publishDiagnostics"},
         {"params", boost::json::object{
@@ -147,7 +151,7 @@ auto semantic_token(const xlang::Token& token, std::size_t length,
 
 auto semantic_type(const xlang::TypeIdentifier& type, boost::json::array& data,
                    xlang::Source& previous) -> void {
-    semantic_token(type.tokens.name, type.name.length(),
+    semantic_token(type.tokens.name, type.name.str().length(),
                    SemanticTokenType::type, SemanticTokenModifier::none, data,
                    previous);
     for (const auto& generic_parameter : type.generic_parameters) {
@@ -155,111 +159,120 @@ auto semantic_type(const xlang::TypeIdentifier& type, boost::json::array& data,
     }
 }
 
-auto semantic_node(xlang::Node node, boost::json::array& data,
-                   xlang::Source& previous) -> void {
-    switch (node.type) {
-    case xlang::NodeType::variable_definition: {
-        auto value = std::get<xlang::VariableDefinition>(node.value);
-        semantic_token(value.tokens.keyword, 3, SemanticTokenType::keyword,
-                       SemanticTokenModifier::none, data, previous);
-        semantic_token(
-            value.tokens.identifier,
-            std::get<std::string>(value.tokens.identifier.value).length(),
-            SemanticTokenType::variable, SemanticTokenModifier::none, data,
-            previous);
-        semantic_node(*value.value, data, previous);
-    } break;
-    case xlang::NodeType::string_literal: {
-        auto value = std::get<xlang::StringLiteral>(node.value);
-        semantic_token(value.token, value.value.length() + 2,
-                       SemanticTokenType::string, SemanticTokenModifier::none,
-                       data, previous);
-    } break;
-    case xlang::NodeType::integer_literal: {
-        auto value = std::get<xlang::IntegerLiteral>(node.value);
-        semantic_token(value.token,
-                       std::get<std::string>(value.token.value).length(),
-                       SemanticTokenType::number, SemanticTokenModifier::none,
-                       data, previous);
-    } break;
-    case xlang::NodeType::identifier: {
-        auto value = std::get<xlang::Identifier>(node.value);
-        semantic_token(value.token, value.name.length(),
-                       SemanticTokenType::variable, SemanticTokenModifier::none,
-                       data, previous);
-    } break;
-    case xlang::NodeType::struct_definition: {
-        auto value = std::get<xlang::StructDefinition>(node.value);
-        semantic_token(value.tokens.keyword, std::string("struct").length(),
-                       SemanticTokenType::keyword, SemanticTokenModifier::none,
-                       data, previous);
-        semantic_token(
-            value.tokens.identifier,
-            std::get<std::string>(value.tokens.identifier.value).length(),
-            SemanticTokenType::type, SemanticTokenModifier::declaration, data,
-            previous);
-        for (const auto& member : value.members) {
-            semantic_token(member.tokens.name, member.name.length(),
-                           SemanticTokenType::parameter,
-                           SemanticTokenModifier::none, data, previous);
-            semantic_type(member.type, data, previous);
-        }
-    } break;
-    case xlang::NodeType::function_definition: {
-        auto value = std::get<xlang::FunctionDefinition>(node.value);
-        if (value.tokens.external.has_value()) {
-            semantic_token(value.tokens.external.value(),
-                           std::string("extern").length(),
-                           SemanticTokenType::keyword,
-                           SemanticTokenModifier::declaration, data, previous);
-        }
-        semantic_token(value.tokens.keyword, 2, SemanticTokenType::keyword,
-                       SemanticTokenModifier::none, data, previous);
-        semantic_token(
-            value.tokens.identifier,
-            std::get<std::string>(value.tokens.identifier.value).length(),
-            SemanticTokenType::function, SemanticTokenModifier::none, data,
-            previous);
-        for (const auto& param : value.parameters) {
-            semantic_token(param.tokens.identifier, param.name.length(),
-                           SemanticTokenType::parameter,
-                           SemanticTokenModifier::none, data, previous);
-            semantic_type(param.type, data, previous);
-        }
-        if (value.return_type.has_value()) {
-            semantic_type(value.return_type.value(), data, previous);
-        }
-        for (const auto& body : value.body) {
-            semantic_node(body, data, previous);
-        }
-        if (value.tokens._return.has_value()) {
-            semantic_token(value.tokens._return.value(),
-                           std::string("return").length(),
+// Walks the tree with an explicit stack, so deeply nested calls and long
+// chains take no stack. Tokens that come after a node's children, such as
+// `return` after a body, wait on the stack with them.
+auto semantic_node(const xlang::Ast& ast, xlang::NodeId root,
+                   boost::json::array& data, xlang::Source& previous) -> void {
+    auto pending = std::vector<std::variant<xlang::NodeId, xlang::Token>>{root};
+    auto queue = [&](std::span<const xlang::NodeId> ids) {
+        pending.insert(pending.end(), ids.rbegin(), ids.rend());
+    };
+
+    while (!pending.empty()) {
+        const auto piece = pending.back();
+        pending.pop_back();
+        if (const auto* const keyword = std::get_if<xlang::Token>(&piece)) {
+            semantic_token(*keyword, std::string("return").length(),
                            SemanticTokenType::keyword,
                            SemanticTokenModifier::none, data, previous);
+            continue;
         }
-        if (value.return_value != nullptr) {
-            semantic_node(*value.return_value, data, previous);
-        }
-    } break;
-    case xlang::NodeType::function_call: {
-        auto funcal = std::get<xlang::FunctionCall>(node.value);
-        semantic_token(
-            funcal.tokens.identifier,
-            std::get<std::string>(funcal.tokens.identifier.value).length(),
-            SemanticTokenType::function, SemanticTokenModifier::none, data,
-            previous);
-        for (const auto& arg : funcal.arguments) {
-            semantic_node(arg, data, previous);
-        }
-    } break;
-    case xlang::NodeType::member_access: {
-        auto value = std::get<xlang::MemberAccess>(node.value);
-        semantic_node(*value.base, data, previous);
-        semantic_node(*value.member, data, previous);
-    } break;
-    default:
-        break;
+
+        xlang::visit(
+            ast, std::get<xlang::NodeId>(piece),
+            xlang::Overloaded{
+                [&](const xlang::VariableDefinition& value) {
+                    semantic_token(value.tokens.keyword, 3,
+                                   SemanticTokenType::keyword,
+                                   SemanticTokenModifier::none, data, previous);
+                    semantic_token(value.tokens.identifier,
+                                   value.tokens.identifier.value.length(),
+                                   SemanticTokenType::variable,
+                                   SemanticTokenModifier::none, data, previous);
+                    pending.emplace_back(value.value);
+                },
+                [&](const xlang::StringLiteral& value) {
+                    semantic_token(value.token, value.value.length() + 2,
+                                   SemanticTokenType::string,
+                                   SemanticTokenModifier::none, data, previous);
+                },
+                [&](const xlang::IntegerLiteral& value) {
+                    semantic_token(value.token, value.token.value.length(),
+                                   SemanticTokenType::number,
+                                   SemanticTokenModifier::none, data, previous);
+                },
+                [&](const xlang::Identifier& value) {
+                    semantic_token(value.token, value.name.str().length(),
+                                   SemanticTokenType::variable,
+                                   SemanticTokenModifier::none, data, previous);
+                },
+                [&](const xlang::StructDefinition& value) {
+                    semantic_token(value.tokens.keyword,
+                                   std::string("struct").length(),
+                                   SemanticTokenType::keyword,
+                                   SemanticTokenModifier::none, data, previous);
+                    semantic_token(value.tokens.identifier,
+                                   value.tokens.identifier.value.length(),
+                                   SemanticTokenType::type,
+                                   SemanticTokenModifier::declaration, data,
+                                   previous);
+                    for (const auto& member : ast[value.members]) {
+                        semantic_token(member.tokens.name,
+                                       member.name.str().length(),
+                                       SemanticTokenType::parameter,
+                                       SemanticTokenModifier::none, data,
+                                       previous);
+                        semantic_type(member.type, data, previous);
+                    }
+                },
+                [&](const xlang::FunctionDefinition& value) {
+                    if (value.tokens.external.has_value()) {
+                        semantic_token(value.tokens.external.value(),
+                                       std::string("extern").length(),
+                                       SemanticTokenType::keyword,
+                                       SemanticTokenModifier::declaration, data,
+                                       previous);
+                    }
+                    semantic_token(value.tokens.keyword, 2,
+                                   SemanticTokenType::keyword,
+                                   SemanticTokenModifier::none, data, previous);
+                    semantic_token(value.tokens.identifier,
+                                   value.tokens.identifier.value.length(),
+                                   SemanticTokenType::function,
+                                   SemanticTokenModifier::none, data, previous);
+                    for (const auto& param : ast[value.parameters]) {
+                        semantic_token(param.tokens.identifier,
+                                       param.name.str().length(),
+                                       SemanticTokenType::parameter,
+                                       SemanticTokenModifier::none, data,
+                                       previous);
+                        semantic_type(param.type, data, previous);
+                    }
+                    if (value.return_type.has_value()) {
+                        semantic_type(value.return_type.value(), data,
+                                      previous);
+                    }
+                    if (value.return_value.has_value()) {
+                        pending.emplace_back(value.return_value.value());
+                    }
+                    if (value.tokens._return.has_value()) {
+                        pending.emplace_back(value.tokens._return.value());
+                    }
+                    queue(ast[value.body]);
+                },
+                [&](const xlang::FunctionCall& funcal) {
+                    semantic_token(funcal.tokens.identifier,
+                                   funcal.tokens.identifier.value.length(),
+                                   SemanticTokenType::function,
+                                   SemanticTokenModifier::none, data, previous);
+                    queue(ast[funcal.arguments]);
+                },
+                [&](const xlang::MemberAccess& value) {
+                    pending.emplace_back(value.member);
+                    pending.emplace_back(value.base);
+                },
+            });
     }
 }
 
@@ -287,11 +300,12 @@ auto handle(Request request, Context& ctx)
         auto data = boost::json::array{};
         auto diagnostics = xlang::Diagnostics{};
         auto tokens = xlang::lex(ctx.files[uri], diagnostics);
-        auto ast = xlang::parse(tokens, diagnostics);
+        auto ast = xlang::Ast{};
+        const auto roots = xlang::parse(tokens, ast, diagnostics);
 
         auto previous = xlang::Source{};
-        for (const auto& node : ast) {
-            semantic_node(node, data, previous);
+        for (const auto node : ast[roots]) {
+            semantic_node(ast, node, data, previous);
         }
 
         return boost::json::object{{"data", data}};